@@ -1,3 +1,17 @@
-from .fastcon_controller import CONFIG_SCHEMA, DEPENDENCIES, FastconController, to_code
+from .fastcon_controller import (
+    AUTO_LOAD,
+    CONFIG_SCHEMA,
+    DEPENDENCIES,
+    FINAL_VALIDATE_SCHEMA,
+    FastconController,
+    to_code,
+)
 
-__all__ = ["CONFIG_SCHEMA", "DEPENDENCIES", "FastconController", "to_code"]
+__all__ = [
+    "AUTO_LOAD",
+    "CONFIG_SCHEMA",
+    "DEPENDENCIES",
+    "FINAL_VALIDATE_SCHEMA",
+    "FastconController",
+    "to_code",
+]
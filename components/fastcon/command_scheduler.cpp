@@ -0,0 +1,140 @@
+#include <algorithm>
+#include "command_scheduler.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        void CommandScheduler::set_capacity(size_t capacity)
+        {
+            capacity_ = capacity;
+            // Reserve once so steady-state operation never allocates
+            entries_.reserve(capacity);
+        }
+
+        CommandScheduler::PushResult CommandScheduler::push(const Command &cmd)
+        {
+            // Replace a pending command for the same target, keeping the higher of the two priorities so
+            // a lower-priority update never adds a second entry. A pending factory reset stays: it must
+            // not be swallowed by a later update, which queues behind it instead
+            for (auto &entry : entries_)
+            {
+                if (entry.target != cmd.target || (entry.op == CommandOp::FACTORY_RESET && cmd.op != CommandOp::FACTORY_RESET))
+                    continue;
+                const CommandPriority priority = std::max(entry.priority, cmd.priority);
+                uint32_t order = entry.order;
+                uint32_t round = entry.round;
+                uint32_t timestamp = entry.timestamp;
+                entry = cmd;
+                entry.priority = priority;
+                entry.order = order;
+                entry.round = round;
+                entry.timestamp = timestamp;
+                return PushResult::COALESCED;
+            }
+
+            Command added = cmd;
+            added.order = next_order_++;
+            added.round = served(cmd.target) ? round_ + 1 : round_;
+
+            if (entries_.size() < capacity_)
+            {
+                entries_.push_back(added);
+                return PushResult::QUEUED;
+            }
+
+            if (entries_.empty())
+                return PushResult::DROPPED;
+
+            // Evict the entry that would be transmitted last if there were no rounds
+            size_t victim = 0;
+            for (size_t i = 1; i < entries_.size(); i++)
+            {
+                if (outranks(entries_[victim], entries_[i]))
+                    victim = i;
+            }
+
+            if (entries_[victim].priority > cmd.priority)
+                return PushResult::DROPPED;
+
+            entries_[victim] = added;
+            return PushResult::EVICTED;
+        }
+
+        size_t CommandScheduler::best_index() const
+        {
+            size_t best = 0;
+            for (size_t i = 1; i < entries_.size(); i++)
+            {
+                if (runs_before(entries_[i], entries_[best]))
+                    best = i;
+            }
+            return best;
+        }
+
+        bool CommandScheduler::pop(Command &out)
+        {
+            if (entries_.empty())
+                return false;
+
+            take(best_index(), out);
+            serve(out);
+            return true;
+        }
+
+        void CommandScheduler::serve(const Command &cmd)
+        {
+            // System commands skip the rounds and do not use up the target's turn
+            if (cmd.priority == CommandPriority::SYSTEM)
+                return;
+
+            // Nothing is left in the current round once the next command belongs to a later one
+            if (static_cast<int32_t>(cmd.round - round_) > 0)
+            {
+                round_ = cmd.round;
+                served_ = {};
+            }
+            const size_t bit = served_bit(cmd.target);
+            served_[bit >> 5] |= 1u << (bit & 31);
+        }
+
+        const Command *CommandScheduler::peek() const
+        {
+            if (entries_.empty())
+                return nullptr;
+            return &entries_[best_index()];
+        }
+
+        void CommandScheduler::take(size_t index, Command &out)
+        {
+            out = entries_[index];
+            // Order is tracked explicitly, so the slot can be filled from the back
+            entries_[index] = entries_.back();
+            entries_.pop_back();
+        }
+
+        const Command *CommandScheduler::find(uint32_t target) const
+        {
+            for (const auto &entry : entries_)
+            {
+                if (entry.target == target)
+                    return &entry;
+            }
+            return nullptr;
+        }
+
+        bool CommandScheduler::remove(uint32_t target)
+        {
+            for (size_t i = 0; i < entries_.size(); i++)
+            {
+                if (entries_[i].target == target)
+                {
+                    Command removed;
+                    take(i, removed);
+                    return true;
+                }
+            }
+            return false;
+        }
+    } // namespace fastcon
+} // namespace esphome
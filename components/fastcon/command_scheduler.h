@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "protocol.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Higher priorities are transmitted first and evicted last
+        enum class CommandPriority : uint8_t
+        {
+            EFFECT = 0, // Effect / music mode frames (send_raw_command)
+            NORMAL = 1, // Light state changes from ESPHome
+            SYSTEM = 2  // Factory reset and pairing
+        };
+
+        // Scheduler key for a command destination; groups use their own key space
+        static const uint32_t TARGET_GROUP_FLAG = 0x80000000;
+        inline uint32_t light_target(uint32_t light_id) { return light_id; }
+        inline uint32_t group_target(uint32_t group_id) { return TARGET_GROUP_FLAG | group_id; }
+
+        enum class CommandOp : uint8_t
+        {
+            STATE,        // Light data (as produced by get_light_data()) for a light or group
+            RAW,          // Control data sent unchanged (send_raw_command)
+            FACTORY_RESET, // No data; encoded as an all-zero control payload
+            STREAM,        // Streaming effect frame, encoded like RAW; empty data ends the stream
+            RECEIVED       // Heard from the mesh, never transmitted: sequence number, then any light data
+        };
+
+        using CommandData = FixedBuffer<MAX_COMMAND_DATA_SIZE>;
+
+        // Logical command; it is only encoded into a packet when it is transmitted
+        struct Command
+        {
+            uint32_t target{0};
+            uint32_t timestamp{0};
+            uint32_t order{0}; // Insertion order, used for FIFO ordering within a priority
+            uint32_t round{0}; // Service round the command is transmitted in (fair scheduling)
+            CommandData data;
+            CommandOp op{CommandOp::STATE};
+            CommandPriority priority{CommandPriority::NORMAL};
+            uint8_t retries{0};
+            static constexpr uint8_t MAX_RETRIES = 3;
+        };
+
+        // Bounded command queue that keeps at most one pending command per target (latest wins,
+        // keeping its place in line and the higher priority; only a pending factory reset is never
+        // replaced), pops highest priority first and on overflow evicts the lowest-priority, oldest
+        // entry instead of refusing the new command.
+        //
+        // Priority decides first, so a light state never waits behind effect frames. Among entries of
+        // the same priority targets are served in rounds: a target that already transmitted in the
+        // current round waits for the next one, so every waiting light gets a packet before any light
+        // gets a second, and insertion order decides within a round. System commands skip the rounds.
+        class CommandScheduler
+        {
+        public:
+            enum class PushResult
+            {
+                QUEUED,    // Added as a new entry
+                COALESCED, // Replaced a pending command for the same target
+                EVICTED,   // Added after evicting a lower-priority entry
+                DROPPED    // Queue full of higher-priority work; command discarded
+            };
+
+            void set_capacity(size_t capacity);
+            size_t capacity() const { return capacity_; }
+
+            PushResult push(const Command &cmd);
+            bool pop(Command &out);
+            // Command pop() would return next, or nullptr
+            const Command *peek() const;
+
+            // Pops the first command in transmit order that satisfies `accept`
+            template<typename F>
+            bool pop_matching(F &&accept, Command &out)
+            {
+                size_t best = entries_.size();
+                for (size_t i = 0; i < entries_.size(); i++)
+                {
+                    if (accept(entries_[i]) && (best == entries_.size() || runs_before(entries_[i], entries_[best])))
+                        best = i;
+                }
+                if (best == entries_.size())
+                    return false;
+                take(best, out);
+                serve(out);
+                return true;
+            }
+
+            // Pending command for `target`, or nullptr
+            const Command *find(uint32_t target) const;
+            bool remove(uint32_t target);
+
+            bool empty() const { return entries_.empty(); }
+            size_t size() const { return entries_.size(); }
+            void clear() { entries_.clear(); }
+
+        protected:
+            // True if `a` should be transmitted before `b`
+            static bool runs_before(const Command &a, const Command &b)
+            {
+                // Rounds only share the air between entries of the same priority
+                if (a.priority != b.priority)
+                    return a.priority > b.priority;
+                if (a.round != b.round)
+                    return static_cast<int32_t>(a.round - b.round) < 0;
+                return static_cast<int32_t>(a.order - b.order) < 0;
+            }
+            // True if `a` should be kept over `b` when the queue is full
+            static bool outranks(const Command &a, const Command &b)
+            {
+                if (a.priority != b.priority)
+                    return a.priority > b.priority;
+                return static_cast<int32_t>(a.order - b.order) < 0;
+            }
+            // Index of the entry to transmit next; entries_ must not be empty
+            size_t best_index() const;
+            void take(size_t index, Command &out);
+            // Accounts for `cmd` being transmitted in the current round
+            void serve(const Command &cmd);
+
+            // Lights and groups have separate halves; light IDs above 255 share bits, which at worst
+            // delays them by a round
+            static size_t served_bit(uint32_t target) { return ((target & TARGET_GROUP_FLAG) ? 256 : 0) | (target & 0xff); }
+            bool served(uint32_t target) const
+            {
+                const size_t bit = served_bit(target);
+                return (served_[bit >> 5] >> (bit & 31)) & 1;
+            }
+
+            std::vector<Command> entries_;
+            size_t capacity_{0};
+            uint32_t next_order_{0};
+            uint32_t round_{0};
+            // Targets that transmitted in round_
+            std::array<uint32_t, 512 / 32> served_{};
+        };
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,74 @@
+#include "controller_metrics.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        static void store_max(std::atomic<uint32_t> &target, uint32_t value)
+        {
+            uint32_t current = target.load(std::memory_order_relaxed);
+            while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        uint32_t ControllerMetrics::Snapshot::latency_percentile(uint8_t percent) const
+        {
+            if (latency_count == 0)
+                return 0;
+
+            // Rank of the percentile sample, rounded up so p100 is the slowest command
+            const uint32_t rank = (static_cast<uint64_t>(latency_count) * percent + 99) / 100;
+            uint32_t seen = 0;
+            for (size_t i = 0; i < LATENCY_BUCKETS - 1; i++)
+            {
+                seen += latency_histogram[i];
+                if (seen >= rank)
+                    return bucket_limit(i);
+            }
+            // The overflow bucket has no upper bound; the maximum is the best estimate
+            return latency_max;
+        }
+
+        void ControllerMetrics::record_latency(uint32_t latency)
+        {
+            size_t bucket = 0;
+            while (bucket < LATENCY_BUCKETS - 1 && latency > bucket_limit(bucket))
+                bucket++;
+            latency_histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+            latency_count_.fetch_add(1, std::memory_order_relaxed);
+            latency_sum_.fetch_add(latency, std::memory_order_relaxed);
+            store_max(latency_max_, latency);
+        }
+
+        void ControllerMetrics::record_queue_depth(size_t depth)
+        {
+            store_max(queue_high_water_, static_cast<uint32_t>(depth));
+        }
+
+        void ControllerMetrics::record_advertisement(uint16_t air_time)
+        {
+            packets_.fetch_add(1, std::memory_order_relaxed);
+            air_time_.fetch_add(air_time, std::memory_order_relaxed);
+        }
+
+        ControllerMetrics::Snapshot ControllerMetrics::take(uint32_t now)
+        {
+            Snapshot snapshot;
+            for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+                snapshot.latency_histogram[i] = latency_histogram_[i].exchange(0, std::memory_order_relaxed);
+            snapshot.latency_count = latency_count_.exchange(0, std::memory_order_relaxed);
+            snapshot.latency_sum = latency_sum_.exchange(0, std::memory_order_relaxed);
+            snapshot.latency_max = latency_max_.exchange(0, std::memory_order_relaxed);
+            snapshot.queue_high_water = queue_high_water_.exchange(0, std::memory_order_relaxed);
+            snapshot.packets = packets_.exchange(0, std::memory_order_relaxed);
+            snapshot.air_time = air_time_.exchange(0, std::memory_order_relaxed);
+            snapshot.dropped = dropped_.load(std::memory_order_relaxed);
+            snapshot.coalesced = coalesced_.load(std::memory_order_relaxed);
+            snapshot.duplicates = duplicates_.load(std::memory_order_relaxed);
+            snapshot.elapsed = now - interval_start_;
+            interval_start_ = now;
+            return snapshot;
+        }
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Counters behind the controller's diagnostic sensors. Recording is a few relaxed atomic
+        // operations so it can happen on the hot path from any task; take() hands the values of the
+        // last interval to the publisher and starts a new one.
+        class ControllerMetrics
+        {
+        public:
+            // Enqueue-to-air latency buckets: <= 8ms, <= 16ms, ... <= 8192ms, then everything above
+            static const size_t LATENCY_BUCKETS = 12;
+            static uint32_t bucket_limit(size_t bucket) { return 8u << bucket; }
+
+            struct Snapshot
+            {
+                std::array<uint32_t, LATENCY_BUCKETS> latency_histogram{};
+                uint32_t latency_count{0};
+                uint32_t latency_sum{0};
+                uint32_t latency_max{0};
+                uint32_t queue_high_water{0};
+                uint32_t packets{0};
+                uint32_t air_time{0};  // ms
+                uint32_t elapsed{0};   // ms covered by this snapshot
+                // Totals since boot
+                uint32_t dropped{0};
+                uint32_t coalesced{0};
+                uint32_t duplicates{0};
+
+                // Upper bound (ms) of the bucket holding the `percent` percentile, 0 if nothing was sent
+                uint32_t latency_percentile(uint8_t percent) const;
+            };
+
+            // A command reached the air `latency` ms after it was queued
+            void record_latency(uint32_t latency);
+            void record_queue_depth(size_t depth);
+            // An advertisement went on air for `air_time` ms
+            void record_advertisement(uint16_t air_time);
+            void record_dropped() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+            void record_coalesced() { coalesced_.fetch_add(1, std::memory_order_relaxed); }
+            void record_duplicate() { duplicates_.fetch_add(1, std::memory_order_relaxed); }
+
+            void start(uint32_t now) { interval_start_ = now; }
+            Snapshot take(uint32_t now);
+
+        protected:
+            std::array<std::atomic<uint32_t>, LATENCY_BUCKETS> latency_histogram_{};
+            std::atomic<uint32_t> latency_count_{0};
+            std::atomic<uint32_t> latency_sum_{0};
+            std::atomic<uint32_t> latency_max_{0};
+            std::atomic<uint32_t> queue_high_water_{0};
+            std::atomic<uint32_t> packets_{0};
+            std::atomic<uint32_t> air_time_{0};
+            std::atomic<uint32_t> dropped_{0};
+            std::atomic<uint32_t> coalesced_{0};
+            std::atomic<uint32_t> duplicates_{0};
+            uint32_t interval_start_{0};
+        };
+    } // namespace fastcon
+} // namespace esphome
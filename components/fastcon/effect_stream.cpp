@@ -0,0 +1,59 @@
+#include "effect_stream.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        bool EffectStream::update(uint32_t target, const CommandData &frame)
+        {
+            for (uint8_t i = 0; i < count_; i++)
+            {
+                if (slots_[i].target != target)
+                    continue;
+
+                // Re-sending a frame the light already shows would only waste air time
+                if (!(dirty_ & (1u << i)) && slots_[i].frame == frame)
+                    return true;
+                slots_[i].frame = frame;
+                dirty_ |= 1u << i;
+                return true;
+            }
+
+            if (count_ >= MAX_LIGHTS)
+                return false;
+
+            slots_[count_].target = target;
+            slots_[count_].frame = frame;
+            dirty_ |= 1u << count_;
+            count_++;
+            return true;
+        }
+
+        bool EffectStream::next(uint32_t &target, CommandData &frame)
+        {
+            if (dirty_ == 0)
+                return false;
+
+            for (uint8_t n = 0; n < count_; n++)
+            {
+                uint8_t i = (cursor_ + n) % count_;
+                if (!(dirty_ & (1u << i)))
+                    continue;
+
+                dirty_ &= ~(1u << i);
+                cursor_ = (i + 1) % count_;
+                target = slots_[i].target;
+                frame = slots_[i].frame;
+                return true;
+            }
+            return false;
+        }
+
+        void EffectStream::clear()
+        {
+            dirty_ = 0;
+            count_ = 0;
+            cursor_ = 0;
+        }
+    } // namespace fastcon
+} // namespace esphome
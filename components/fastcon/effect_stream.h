@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "command_scheduler.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Latest-frame-wins buffer for streaming effects (e.g. music mode). Keeps one frame per
+        // participating light; a newer frame replaces one that has not been sent yet, and unsent
+        // frames are handed out round-robin so every light gets its turn.
+        class EffectStream
+        {
+        public:
+            static const uint8_t MAX_LIGHTS = 32;
+
+            // Stores the newest frame for `target`; returns false if every slot is taken
+            bool update(uint32_t target, const CommandData &frame);
+            // Next target with an unsent frame, continuing after the one sent last
+            bool next(uint32_t &target, CommandData &frame);
+
+            bool pending() const { return dirty_ != 0; }
+            size_t num_lights() const { return count_; }
+            void clear();
+
+        protected:
+            struct Slot
+            {
+                CommandData frame;
+                uint32_t target{0};
+            };
+
+            std::array<Slot, MAX_LIGHTS> slots_{};
+            uint32_t dirty_{0}; // Bit per slot with a frame not yet sent
+            uint8_t count_{0};
+            uint8_t cursor_{0};
+        };
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,148 @@
+#include "esphome/core/log.h"
+#include "extended_advertiser.h"
+
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        static const char *const TAG = "fastcon.ext_adv";
+
+        bool ExtendedAdvertiser::setup(uint8_t num_sets, uint16_t interval_min, uint16_t interval_max)
+        {
+            num_sets_ = 0;
+            if (num_sets > MAX_SETS)
+                num_sets = MAX_SETS;
+
+            esp_ble_gap_ext_adv_params_t params = {
+                .type = ESP_BLE_GAP_SET_EXT_ADV_PROP_LEGACY_NONCONN,
+                .interval_min = interval_min,
+                .interval_max = interval_max,
+                .channel_map = ADV_CHNL_ALL,
+                .own_addr_type = BLE_ADDR_TYPE_RANDOM,
+                .peer_addr_type = BLE_ADDR_TYPE_PUBLIC,
+                .peer_addr = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+                .filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+                .tx_power = EXT_ADV_TX_PWR_NO_PREFERENCE,
+                .primary_phy = ESP_BLE_GAP_PRI_PHY_1M,
+                .max_skip = 0,
+                .secondary_phy = ESP_BLE_GAP_PHY_1M,
+                .sid = 0,
+                .scan_req_notif = false,
+            };
+
+            for (uint8_t i = 0; i < num_sets; i++)
+            {
+                params.sid = i;
+                esp_err_t err = esp_ble_gap_ext_adv_set_params(i, &params);
+                if (err != ESP_OK)
+                {
+                    ESP_LOGW(TAG, "Error configuring advertising set %d: %s", i, esp_err_to_name(err));
+                    return false;
+                }
+
+                // Each set needs its own static random address (two most significant bits set)
+                esp_bd_addr_t addr = {0xC0, 0xFA, 0x57, 0xC0, 0x00, i};
+                err = esp_ble_gap_ext_adv_set_rand_addr(i, addr);
+                if (err != ESP_OK)
+                {
+                    ESP_LOGW(TAG, "Error setting address of advertising set %d: %s", i, esp_err_to_name(err));
+                    return false;
+                }
+            }
+
+            num_sets_ = num_sets;
+            for (auto &set : sets_)
+            {
+                set = AdvertisingSet{};
+            }
+            return true;
+        }
+
+        void ExtendedAdvertiser::update(uint32_t now, uint16_t gap)
+        {
+            for (uint8_t i = 0; i < num_sets_; i++)
+            {
+                auto &set = sets_[i];
+                if (set.state == SetState::ADVERTISING && now - set.since >= set.duration)
+                {
+                    stop(i);
+                    set.state = SetState::GAP;
+                    set.since = now;
+                }
+                else if (set.state == SetState::GAP && now - set.since >= gap)
+                {
+                    set.state = SetState::IDLE;
+                }
+            }
+        }
+
+        int ExtendedAdvertiser::idle_set() const
+        {
+            for (uint8_t i = 0; i < num_sets_; i++)
+            {
+                if (sets_[i].state == SetState::IDLE)
+                    return i;
+            }
+            return -1;
+        }
+
+        bool ExtendedAdvertiser::busy() const
+        {
+            for (uint8_t i = 0; i < num_sets_; i++)
+            {
+                if (sets_[i].state != SetState::IDLE)
+                    return true;
+            }
+            return false;
+        }
+
+        bool ExtendedAdvertiser::start(uint8_t set, const uint8_t *raw, size_t len, uint32_t now, uint16_t duration)
+        {
+            esp_err_t err = esp_ble_gap_config_ext_adv_data_raw(set, len, raw);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Error setting data of advertising set %d: %s", set, esp_err_to_name(err));
+                return false;
+            }
+
+            // Duration is managed by update() so every backend shares the same timing
+            esp_ble_gap_ext_adv_t ext_adv = {
+                .instance = set,
+                .duration = 0,
+                .max_events = 0,
+            };
+            err = esp_ble_gap_ext_adv_start(1, &ext_adv);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Error starting advertising set %d: %s", set, esp_err_to_name(err));
+                return false;
+            }
+
+            sets_[set].state = SetState::ADVERTISING;
+            sets_[set].since = now;
+            sets_[set].duration = duration;
+            return true;
+        }
+
+        void ExtendedAdvertiser::stop(uint8_t set)
+        {
+            esp_ble_gap_ext_adv_stop(1, &set);
+        }
+
+        void ExtendedAdvertiser::stop_all()
+        {
+            uint8_t instances[MAX_SETS];
+            for (uint8_t i = 0; i < num_sets_; i++)
+            {
+                instances[i] = i;
+                sets_[i] = AdvertisingSet{};
+            }
+            if (num_sets_ > 0)
+                esp_ble_gap_ext_adv_stop(num_sets_, instances);
+        }
+    } // namespace fastcon
+} // namespace esphome
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#include "esphome/components/esp32_ble_server/ble_server.h"
+#ifdef USE_ESP32
+#include <sdkconfig.h>
+#endif
+
+#if defined(USE_FASTCON_EXTENDED_ADVERTISING) && defined(CONFIG_BT_BLE_50_FEATURES_SUPPORTED)
+#define FASTCON_HAS_EXTENDED_ADVERTISING
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Runs several BLE 5 advertising sets in parallel. Each set still carries a legacy
+        // non-connectable PDU, since that is all the bulbs listen for.
+        class ExtendedAdvertiser
+        {
+        public:
+            static const uint8_t MAX_SETS = 4;
+
+            bool setup(uint8_t num_sets, uint16_t interval_min, uint16_t interval_max);
+            uint8_t num_sets() const { return num_sets_; }
+
+            // Stops sets whose air time has elapsed and frees them once their gap has passed
+            void update(uint32_t now, uint16_t gap);
+
+            // Index of a set ready for new data, or -1 if all are busy
+            int idle_set() const;
+            bool busy() const;
+
+            bool start(uint8_t set, const uint8_t *raw, size_t len, uint32_t now, uint16_t duration);
+            void stop(uint8_t set);
+            void stop_all();
+
+        protected:
+            enum class SetState : uint8_t
+            {
+                IDLE,
+                ADVERTISING,
+                GAP
+            };
+
+            struct AdvertisingSet
+            {
+                SetState state{SetState::IDLE};
+                uint32_t since{0};
+                uint16_t duration{0};
+            };
+
+            std::array<AdvertisingSet, MAX_SETS> sets_{};
+            uint8_t num_sets_{0};
+        };
+    } // namespace fastcon
+} // namespace esphome
+
+#endif
@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <cmath>
 #include "esphome/core/component_iterator.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
-#include "esphome/components/light/color_mode.h"
 #include "fastcon_controller.h"
 #include "protocol.h"
+#include "utils.h"
+#ifdef USE_ESP32
+#include <sdkconfig.h>
+#endif
 
 namespace esphome
 {
@@ -10,382 +16,1322 @@ namespace esphome
     {
         static const char *const TAG = "fastcon.controller";
 
-        void FastconController::queueCommand(uint32_t light_id_, const std::vector<uint8_t> &data)
+        bool FastconController::queueCommand(uint32_t light_id_, CommandOp op, const uint8_t *data, size_t len, CommandPriority priority)
         {
-            std::lock_guard<std::mutex> lock(queue_mutex_);
-            if (queue_.size() >= max_queue_size_)
+            Command cmd;
+            if (!cmd.data.assign(data, len))
+            {
+                ESP_LOGW(TAG, "Command for light %d too large (%d bytes, max %d), dropping", light_id_, len, MAX_COMMAND_DATA_SIZE);
+                return false;
+            }
+            cmd.target = light_target(light_id_);
+            cmd.timestamp = millis();
+            cmd.op = op;
+            cmd.priority = priority;
+            cmd.retries = 0;
+
+            return enqueue(cmd);
+        }
+
+        void FastconController::start_effect(const std::vector<uint8_t> &lights, float fps, EffectRenderer renderer)
+        {
+            if (lights.size() > EffectStream::MAX_LIGHTS)
+                ESP_LOGW(TAG, "Streaming effect supports at most %d lights, extra lights are ignored", EffectStream::MAX_LIGHTS);
+
+            fps = std::max(1.0f, std::min(fps, 100.0f));
+            effect_lights_ = lights;
+            effect_renderer_ = std::move(renderer);
+            effect_interval_ms_ = static_cast<uint32_t>(1000.0f / fps);
+            last_effect_frame_ = millis() - effect_interval_ms_;
+            ESP_LOGD(TAG, "Started streaming effect on %d lights at %.1f fps", lights.size(), fps);
+        }
+
+        void FastconController::stop_effect()
+        {
+            effect_renderer_ = nullptr;
+            effect_lights_.clear();
+
+            // Travels through the inbox so frames queued before it are discarded too. A full inbox
+            // holds only frames from before the stop, so the consumer then drops every frame in it
+            Command cmd;
+            cmd.op = CommandOp::STREAM;
+            cmd.priority = CommandPriority::EFFECT;
+            cmd.timestamp = millis();
+            if (!inbox_.push(cmd))
+                stream_stop_requested_ = true;
+            if (adv_task_ != nullptr)
+                xTaskNotifyGive(adv_task_);
+        }
+
+        bool FastconController::stream_frame(uint8_t light_id, const uint8_t *data, size_t len)
+        {
+            if (len == 0)
+                return false;
+            return queueCommand(light_id, CommandOp::STREAM, data, len, CommandPriority::EFFECT);
+        }
+
+        void FastconController::render_effect(uint32_t now)
+        {
+            if (!effect_renderer_ || now - last_effect_frame_ < effect_interval_ms_)
+                return;
+            last_effect_frame_ = now;
+
+            CommandData frame;
+            for (uint8_t light_id : effect_lights_)
+            {
+                frame.clear();
+                if (effect_renderer_(light_id, now, frame) && !frame.empty())
+                    stream_frame(light_id, frame.data(), frame.size());
+            }
+        }
+
+        bool FastconController::queue_state(uint32_t target, const LightData &state)
+        {
+            Command cmd;
+            cmd.data.assign(state.data(), state.size());
+            cmd.target = target;
+            cmd.timestamp = millis();
+            cmd.op = CommandOp::STATE;
+            cmd.priority = CommandPriority::NORMAL;
+            cmd.retries = 0;
+
+            return enqueue(cmd);
+        }
+
+        uint16_t FastconController::add_light(uint32_t target, uint16_t debounce, uint16_t min_interval, light::LightOutput *output,
+                                              LightEncoder encoder)
+        {
+            const uint16_t index = lights_.add(target, debounce, min_interval);
+            if (index != LightDebouncer::INVALID_INDEX)
+                scene_lights_.push_back({output, encoder});
+            return index;
+        }
+
+        void FastconController::set_light_state(uint16_t index, const LightData &state)
+        {
+            lights_.update(index, state, millis());
+        }
+
+        bool FastconController::send_light_state(uint16_t index, uint32_t target, const LightData &state)
+        {
+            if (!queue_state(target, state))
+                return false;
+            lights_.mark_sent(index, millis());
+            return true;
+        }
+
+        void FastconController::flush_lights(uint32_t now)
+        {
+            // **OPTIMIZATION: Debounced command sending** - one pass over the lights with a pending state
+            lights_.flush(now, [this](uint32_t target, const LightData &state, [[maybe_unused]] uint32_t delay)
+                          {
+                              // Inbox full: the remaining lights stay pending until a later loop. Checked up
+                              // front so a retry every loop does not log and count a drop each time
+                              if (inbox_.size() >= inbox_.capacity())
+                              {
+                                  ESP_LOGV(TAG, "Command inbox full, retrying pending lights later");
+                                  return false;
+                              }
+                              // The state is compared with what the light last received when it is scheduled
+                              if (!queue_state(target, state))
+                                  return false;
+                              ESP_LOGD(TAG, "Queued debounced command for target 0x%08X (delayed %dms)", target, delay);
+                              return true;
+                          });
+        }
+
+        void FastconController::apply_scene(const std::vector<light::LightState *> &lights)
+        {
+            struct Entry
+            {
+                uint32_t target;
+                LightData state;
+                bool merged;
+            };
+            std::vector<Entry> entries;
+            entries.reserve(lights.size());
+            // Scene entry of each light ID, -1 if the light is not in the scene
+            std::array<int16_t, 256> by_light;
+            by_light.fill(-1);
+
+            const uint32_t now = millis();
+            for (light::LightState *state : lights)
+            {
+                auto it = std::find_if(scene_lights_.begin(), scene_lights_.end(),
+                                       [state](const SceneLight &light) { return light.output == state->get_output(); });
+                if (it == scene_lights_.end())
+                {
+                    ESP_LOGW(TAG, "Scene light is not a Fastcon light on this controller, skipped");
+                    continue;
+                }
+
+                // The scene replaces whatever the light was still debouncing
+                const uint16_t index = it - scene_lights_.begin();
+                lights_.mark_sent(index, now);
+
+                Entry entry{lights_.target(index), LightData(), false};
+                it->encoder(state->remote_values, entry.state);
+                if ((entry.target & TARGET_GROUP_FLAG) || entry.target >= by_light.size())
+                {
+                    entries.push_back(entry);
+                    continue;
+                }
+                // A light listed twice keeps its last state
+                if (by_light[entry.target] >= 0)
+                {
+                    entries[by_light[entry.target]] = entry;
+                    continue;
+                }
+                by_light[entry.target] = entries.size();
+                entries.push_back(entry);
+            }
+
+            // One group packet for every group whose members all get the same state; a group that is only
+            // partly in the scene, or split between states, is sent light by light
+            std::vector<Entry> plan;
+            plan.reserve(entries.size());
+            std::array<bool, 256> checked{};
+            for (const Entry &entry : entries)
+            {
+                if ((entry.target & TARGET_GROUP_FLAG) || entry.target >= light_groups_.size())
+                    continue;
+                const uint8_t group_id = light_groups_[entry.target];
+                if (group_id == 0 || checked[group_id])
+                    continue;
+                checked[group_id] = true;
+
+                size_t members = 0;
+                for (size_t light_id = 1; light_id < light_groups_.size(); light_id++)
+                {
+                    if (light_groups_[light_id] != group_id)
+                        continue;
+                    if (by_light[light_id] < 0 || entries[by_light[light_id]].state != entry.state)
+                    {
+                        members = 0;
+                        break;
+                    }
+                    members++;
+                }
+                if (members < 2)
+                    continue;
+
+                for (size_t light_id = 1; light_id < light_groups_.size(); light_id++)
+                {
+                    if (light_groups_[light_id] == group_id)
+                        entries[by_light[light_id]].merged = true;
+                }
+                plan.push_back({group_target(group_id), entry.state, false});
+            }
+            for (const Entry &entry : entries)
+            {
+                if (!entry.merged)
+                    plan.push_back(entry);
+            }
+
+            // Queued back to back, so the scheduler packs the individual states into shared packets
+            size_t queued = 0;
+            for (const Entry &entry : plan)
+            {
+                if (queue_state(entry.target, entry.state))
+                    queued++;
+            }
+            if (queued < plan.size())
+                ESP_LOGW(TAG, "Command queue full, %u of %u scene commands dropped", static_cast<unsigned>(plan.size() - queued),
+                         static_cast<unsigned>(plan.size()));
+            ESP_LOGD(TAG, "Scene: %u lights in %u commands", static_cast<unsigned>(entries.size()), static_cast<unsigned>(plan.size()));
+        }
+
+        bool FastconController::state_is_current(uint32_t target, const CommandData &state) const
+        {
+            // Compare with what the light will end up with: the pending command, else the last transmitted state
+            const Command *pending = queue_.find(target);
+            if (pending != nullptr)
+                return pending->op == CommandOp::STATE && pending->data == state;
+
+            // Group members may be outside this controller's configuration, so group states are never skipped
+            if ((target & TARGET_GROUP_FLAG) || target >= light_states_.size())
+                return false;
+
+            // A pending group state (a scene) covers its members
+            if (light_groups_[target] != 0)
+            {
+                pending = queue_.find(group_target(light_groups_[target]));
+                if (pending != nullptr && pending->op == CommandOp::STATE)
+                    return pending->data == state;
+            }
+            return light_states_[target].matches(state.data(), state.size());
+        }
+
+        void FastconController::remember_state(const Command &cmd)
+        {
+            // Raw and system commands leave the light in an unknown state
+            const bool is_state = cmd.op == CommandOp::STATE;
+            if (cmd.target & TARGET_GROUP_FLAG)
+            {
+                const uint32_t group_id = cmd.target & ~TARGET_GROUP_FLAG;
+                for (size_t light_id = 1; light_id < light_states_.size(); light_id++)
+                {
+                    if (light_groups_[light_id] != group_id)
+                        continue;
+                    if (is_state)
+                        light_states_[light_id].set(cmd.data.data(), cmd.data.size());
+                    else
+                        light_states_[light_id].forget();
+                }
+                return;
+            }
+
+            if (cmd.target >= light_states_.size())
+                return;
+            if (is_state)
+                light_states_[cmd.target].set(cmd.data.data(), cmd.data.size());
+            else
+                light_states_[cmd.target].forget();
+        }
+
+        bool FastconController::enqueue(const Command &cmd)
+        {
+            if (!inbox_.push(cmd))
+            {
+                metrics_.record_dropped();
+                ESP_LOGW(TAG, "Command inbox full (%d), dropping command for target 0x%08X", inbox_.capacity(), cmd.target);
+                return false;
+            }
+            if (adv_task_ != nullptr)
+                xTaskNotifyGive(adv_task_);
+            return true;
+        }
+
+        void FastconController::drain_inbox()
+        {
+            if (clear_requested_.exchange(false))
+            {
+                Command dropped;
+                while (inbox_.pop(dropped))
+                {
+                }
+                queue_.clear();
+                resend_.clear();
+                inflight_.clear();
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+                // Consumer side already, so the sets on air can be stopped right here
+                this->ext_adv_.stop_all();
+#endif
+            }
+
+            const bool stream_stopped = stream_stop_requested_.exchange(false);
+            if (stream_stopped)
+                effects_.clear();
+
+            metrics_.record_queue_depth(inbox_.size() + queue_.size());
+            Command cmd;
+            while (inbox_.pop(cmd))
+            {
+                if (!(stream_stopped && cmd.op == CommandOp::STREAM))
+                    schedule(cmd);
+            }
+            scheduled_count_ = queue_.size();
+        }
+
+        void FastconController::schedule(const Command &cmd)
+        {
+            if (cmd.op == CommandOp::RECEIVED)
+            {
+                handle_received(cmd);
+                return;
+            }
+
+            // Streaming frames bypass the scheduler; only the newest frame per light is kept
+            if (cmd.op == CommandOp::STREAM)
+            {
+                if (cmd.data.empty())
+                    effects_.clear();
+                else if (!effects_.update(cmd.target, cmd.data))
+                    ESP_LOGW(TAG, "Streaming effect is full, dropping frame for target 0x%08X", cmd.target);
+                return;
+            }
+
+            // Another controller transmits for this target; what it sends is unknown here
+            if (!shard_.owns(cmd.target, cmd.timestamp))
+            {
+                if (!(cmd.target & TARGET_GROUP_FLAG) && cmd.target < light_states_.size())
+                    light_states_[cmd.target].forget();
+                ESP_LOGV(TAG, "Target 0x%08X belongs to controller %d, not sending", cmd.target, shard_.shard_of(cmd.target));
+                return;
+            }
+
+            if (cmd.op == CommandOp::STATE && state_is_current(cmd.target, cmd.data))
+            {
+                metrics_.record_duplicate();
+                ESP_LOGV(TAG, "Skipping duplicate state for target 0x%08X", cmd.target);
+                return;
+            }
+
+            // A new command supersedes any repeat or retransmission still owed to the same target
+            resend_.remove(cmd.target);
+            inflight_.remove(cmd.target);
+            switch (queue_.push(cmd))
+            {
+            case CommandScheduler::PushResult::QUEUED:
+                ESP_LOGV(TAG, "Command queued, queue size: %d", queue_.size());
+                break;
+            case CommandScheduler::PushResult::COALESCED:
+                metrics_.record_coalesced();
+                ESP_LOGV(TAG, "Replaced pending command for target 0x%08X", cmd.target);
+                break;
+            case CommandScheduler::PushResult::EVICTED:
+                metrics_.record_dropped();
+                ESP_LOGW(TAG, "Command queue full (size=%d), evicted oldest lowest-priority command", queue_.size());
+                break;
+            case CommandScheduler::PushResult::DROPPED:
+                metrics_.record_dropped();
+                ESP_LOGW(TAG, "Command queue full (size=%d), dropping command for target 0x%08X",
+                         queue_.size(), cmd.target);
+                break;
+            }
+        }
+
+        void FastconController::setup()
+        {
+            ESP_LOGCONFIG(TAG, "Setting up Fastcon BLE Controller...");
+            queue_.set_capacity(MAX_QUEUE_SIZE);
+            resend_.set_capacity(MAX_QUEUE_SIZE);
+            ESP_LOGCONFIG(TAG, "  Advertisement interval: %d-%d", this->adv_interval_min_, this->adv_interval_max_);
+            ESP_LOGCONFIG(TAG, "  Advertisement duration: %dms", this->adv_duration_);
+            ESP_LOGCONFIG(TAG, "  Advertisement gap: %dms", this->adv_gap_);
+            ESP_LOGCONFIG(TAG, "  Max queue size: %d (inbox: %d)", MAX_QUEUE_SIZE, this->inbox_.capacity());
+            if (this->shard_.enabled())
+            {
+                ESP_LOGCONFIG(TAG, "  Shard: %d of %d", this->shard_.index() + 1, this->shard_.count());
+                this->shard_.set_mesh_tag(crc16(this->mesh_key_.data(), this->mesh_key_.size(), nullptr, 0));
+            }
+            if (this->burst_queue_depth_ > 0)
+            {
+                ESP_LOGCONFIG(TAG, "  Adaptive timing: %dms at queue depth >= %d, %dms when idle, resend final state: %s",
+                              this->burst_duration_, this->burst_queue_depth_, this->idle_duration_,
+                              YESNO(this->resend_final_state_));
+            }
+            if (this->timing_.budget() > 0)
+                ESP_LOGCONFIG(TAG, "  Air-time budget: %dms per second", this->timing_.budget());
+
+            if (this->restore_state_)
+            {
+                // One sequence lease and one light table per mesh
+                const uint32_t mesh = (this->mesh_key_[0] << 24) | (this->mesh_key_[1] << 16) | (this->mesh_key_[2] << 8) |
+                                      this->mesh_key_[3];
+                if (this->state_store_.load(fnv1_hash("fastcon_sequence") ^ mesh, fnv1_hash("fastcon_state") ^ mesh,
+                                            this->sequence_, this->light_states_))
+                {
+                    size_t known = 0;
+                    for (const auto &light : this->light_states_)
+                        known += light.known();
+                    ESP_LOGCONFIG(TAG, "  Restored state: sequence %d, %d lights with a known state", this->sequence_, known);
+                }
+                // The first packet already spends the fresh lease taken by load()
+                this->save_lease(true);
+                this->set_interval("save_state", STATE_CHECK_INTERVAL_MS, [this]() { this->save_state(); });
+            }
+
+            this->adv_params_ = {
+                .adv_int_min = this->adv_interval_min_,
+                .adv_int_max = this->adv_interval_max_,
+                .adv_type = ADV_TYPE_NONCONN_IND,
+                .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+                .peer_addr = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+                .peer_addr_type = BLE_ADDR_TYPE_PUBLIC,
+                .channel_map = ADV_CHNL_ALL,
+                .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+            };
+
+            // Also runs without sensors, the latency histogram is logged at debug level
+            this->metrics_.start(millis());
+            if (this->metrics_interval_ > 0)
+                this->set_interval("metrics", this->metrics_interval_, [this]() { this->publish_metrics(); });
+
+            const esp_timer_create_args_t timer_args = {
+                .callback = &FastconController::adv_timer_callback,
+                .arg = this,
+                .dispatch_method = ESP_TIMER_TASK,
+                .name = "fastcon_adv",
+                .skip_unhandled_events = false,
+            };
+            esp_err_t err = esp_timer_create(&timer_args, &this->adv_timer_);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Could not create advertising timer: %s", esp_err_to_name(err));
+                this->mark_failed();
+                return;
+            }
+
+            if (this->advertising_sets_ > 1)
+            {
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+                if (this->ext_adv_.setup(this->advertising_sets_, this->adv_interval_min_, this->adv_interval_max_))
+                {
+                    ESP_LOGCONFIG(TAG, "  Extended advertising: %d sets", this->ext_adv_.num_sets());
+                }
+                else
+                {
+                    ESP_LOGW(TAG, "Extended advertising setup failed, falling back to legacy advertising");
+                }
+#else
+                ESP_LOGW(TAG, "Extended advertising is not available on this chip/SDK, using legacy advertising");
+#endif
+            }
+
+            if (this->advertising_task_)
+            {
+#if defined(CONFIG_FREERTOS_UNICORE)
+                const BaseType_t core = tskNO_AFFINITY;
+#elif defined(CONFIG_BT_BLUEDROID_PINNED_TO_CORE)
+                const BaseType_t core = CONFIG_BT_BLUEDROID_PINNED_TO_CORE;
+#else
+                const BaseType_t core = 0;
+#endif
+                if (xTaskCreatePinnedToCore(&FastconController::advertising_task, "fastcon_adv", ADV_TASK_STACK_SIZE, this,
+                                            ADV_TASK_PRIORITY, &this->adv_task_, core) == pdPASS)
+                {
+                    ESP_LOGCONFIG(TAG, "  Advertising task: priority %d, core %d", ADV_TASK_PRIORITY, core);
+                }
+                else
+                {
+                    this->adv_task_ = nullptr;
+                    ESP_LOGW(TAG, "Could not create advertising task, advertising from the main loop");
+                }
+            }
+        }
+
+        void FastconController::advertising_task(void *arg)
+        {
+            auto *self = static_cast<FastconController *>(arg);
+            for (;;)
+            {
+                // Woken by new commands and the advertising timer; otherwise wakes up for extended set
+                // timing and for work that falls due while idle (retransmissions, heartbeats, scan windows)
+                ulTaskNotifyTake(pdTRUE, self->advertising_task_wait());
+                self->try_drain_inbox();
+                self->run_advertiser(millis());
+            }
+        }
+
+        TickType_t FastconController::advertising_task_wait() const
+        {
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+            // The extended sets are timed by polling, so keep ticking while any of them is on air
+            if (this->ext_adv_.busy())
+                return 1;
+#endif
+            // The timer normally wakes the task on time; this is the fallback if it could not be armed
+            if (this->adv_state_ != AdvertiseState::IDLE)
+                return std::max<TickType_t>(pdMS_TO_TICKS(std::max<int32_t>(this->adv_time_left(millis()), 0)), 1);
+            return pdMS_TO_TICKS(ADV_TASK_IDLE_WAIT_MS);
+        }
+
+        bool FastconController::next_advertisement(uint8_t *raw, size_t &len, uint16_t &duration, uint16_t &gap, bool broadcasts)
+        {
+            // Only serializes the main loop against the advertising task; producers never take this lock
+            std::lock_guard<std::mutex> lock(consumer_mutex_);
+            drain_inbox();
+
+            // Over the air-time budget everything waits, commands stay queued until it has refilled
+            const uint32_t now = millis();
+            if (!timing_.may_transmit(now))
+                return false;
+
+            gap = adv_gap_;
+            if (broadcasts && shard_.heartbeat_due(now))
+            {
+                len = shard_.build_heartbeat(raw);
+                duration = adv_duration_;
+            }
+            else if (broadcasts && take_pairing_slot())
+            {
+                len = build_pairing_adv_data(raw);
+                duration = PAIRING_ADV_DURATION_MS;
+                if (len == 0)
+                    return false;
+            }
+            else
+            {
+                // Effect frames add no relay time of their own; start every packet from zero
+                PacketBuffer packet;
+                packet_relay_time_ = 0;
+                if (!next_command(packet, duration))
+                    return false;
+                len = write_adv_frame(packet, raw);
+
+                // Stay quiet until the bulbs have relayed the packet through the mesh
+                if (packet_relay_time_ > duration + gap)
+                    gap = packet_relay_time_ - duration;
+            }
+
+            timing_.consume(now, duration);
+            return true;
+        }
+
+        bool FastconController::next_command(PacketBuffer &packet, uint16_t &duration)
+        {
+            // Alternate streaming frames with queued work so neither starves the other; system commands
+            // (factory reset) still go first
+            if (effects_.pending())
+            {
+                const Command *top = queue_.peek();
+                if (top == nullptr || (effect_turn_ && top->priority != CommandPriority::SYSTEM))
+                {
+                    effect_turn_ = false;
+                    return next_effect_frame(packet, duration);
+                }
+            }
+            effect_turn_ = true;
+
+            Command cmd;
+            if (queue_.pop(cmd))
+            {
+                collapse_group(cmd);
+                record_latency(cmd, millis());
+            }
+            else if (next_retransmission(millis(), cmd))
+            {
+                ESP_LOGD(TAG, "Retransmitting unacknowledged state for target 0x%08X (attempt %d)", cmd.target, cmd.retries + 1);
+            }
+            else if (resend_.pop(cmd))
+            {
+                // The burst is over; repeat the final state it delivered with normal air time
+                ESP_LOGV(TAG, "Resending final state for target 0x%08X (%d left)", cmd.target, resend_.size());
+            }
+            else
+            {
+                return false;
+            }
+
+            // Pending commands including the one about to be sent
+            const size_t depth = queue_.size() + 1;
+            const bool burst = burst_queue_depth_ > 0 && depth >= burst_queue_depth_;
+            duration = select_duration(depth);
+            if (burst)
+                schedule_repeat(cmd);
+            remember_state(cmd);
+
+            // Encoding happens only now, so every packet (repeats included) gets a fresh sequence number
+            const uint8_t sequence = sequence_;
+            const bool batched = batch_commands(cmd, burst, packet);
+            const bool encoded = batched || encode_command(cmd, packet);
+            // Nothing relays a packet that is not forwarded, so there is no acknowledgement to wait for
+            if (encoded && (batched || forwarded(cmd)))
+                record_sent(sequence, cmd);
+            scheduled_count_ = queue_.size();
+            return encoded;
+        }
+
+        bool FastconController::next_effect_frame(PacketBuffer &packet, uint16_t &duration)
+        {
+            Command cmd;
+            if (!effects_.next(cmd.target, cmd.data))
+                return false;
+
+            cmd.op = CommandOp::STREAM;
+            cmd.priority = CommandPriority::EFFECT;
+            duration = select_duration(queue_.size() + 1);
+            remember_state(cmd);
+            return encode_command(cmd, packet);
+        }
+
+        uint16_t FastconController::select_duration(size_t depth) const
+        {
+            if (burst_queue_depth_ == 0)
+                return adv_duration_;
+            if (depth >= burst_queue_depth_)
+                return burst_duration_;
+            return (depth == 1 && resend_.empty()) ? idle_duration_ : adv_duration_;
+        }
+
+        void FastconController::schedule_repeat(const Command &cmd)
+        {
+            // Only light states are worth repeating; effect frames are stale by the time the burst ends.
+            // With relays to go by, unacknowledged states are retransmitted selectively instead.
+            if (!resend_final_state_ || cmd.op != CommandOp::STATE || cmd.retries >= Command::MAX_RETRIES ||
+                acks_expected(millis()))
+                return;
+
+            Command again = cmd;
+            again.retries++;
+            resend_.push(again);
+        }
+
+        bool FastconController::encode_command(const Command &cmd, PacketBuffer &out)
+        {
+            const uint32_t id = cmd.target & ~TARGET_GROUP_FLAG;
+            switch (cmd.op)
+            {
+            case CommandOp::STATE:
+                if (cmd.target & TARGET_GROUP_FLAG)
+                    return this->group_control(id, cmd.data.data(), cmd.data.size(), out);
+                return this->single_control(id, cmd.data.data(), cmd.data.size(), out, forwarded(cmd));
+
+            case CommandOp::RAW:
+            case CommandOp::STREAM:
+                // Generate mesh packet with command type 5 (control)
+                return this->generate_command(5, id, cmd.data.data(), cmd.data.size(), out, true);
+
+            case CommandOp::FACTORY_RESET:
+            {
+                // Factory reset command: all zeros payload
+                const std::array<uint8_t, 7> reset_data{};
+                return this->generate_command(5, id, reset_data.data(), reset_data.size(), out, true);
+            }
+
+            case CommandOp::RECEIVED:
+                break;
+            }
+            return false;
+        }
+
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+        void FastconController::loop_extended(uint32_t now)
+        {
+            if (stop_sets_requested_.exchange(false))
+                this->ext_adv_.stop_all();
+            this->ext_adv_.update(now, adv_gap_);
+
+            // Fill every idle set with the next command; heartbeats and pairing broadcasts stay on set 0
+            int set;
+            while (scan_.advertising_allowed() && (set = this->ext_adv_.idle_set()) >= 0)
+            {
+                uint8_t adv_data_raw[MAX_PACKET_SIZE] = {0};
+                size_t adv_data_len;
+                uint16_t duration, gap;
+                // The sets advertise in parallel, so relay spacing does not apply; the budget still does
+                if (!next_advertisement(adv_data_raw, adv_data_len, duration, gap, set == 0))
+                    return;
+
+                if (!this->ext_adv_.start(set, adv_data_raw, adv_data_len, now, duration))
+                    return;
+                metrics_.record_advertisement(duration);
+                ESP_LOGV(TAG, "Started advertising on set %d", set);
+            }
+        }
+#endif
+
+        void FastconController::try_drain_inbox()
+        {
+            // Keep the inbox short while the advertiser is busy; skipped if another task is consuming
+            if (consumer_mutex_.try_lock())
+            {
+                drain_inbox();
+                consumer_mutex_.unlock();
+            }
+        }
+
+        void FastconController::loop()
+        {
+            const uint32_t now = millis();
+
+            if (adv_task_ == nullptr)
+                try_drain_inbox();
+
+            // Pairing advertisements are interleaved with normal traffic by the advertiser
+            if (pairing_mode_)
+                update_pairing(now);
+
+            shard_.update(now);
+
+            flush_lights(now);
+
+            if (this->state_store_.lease_pending())
+                this->save_lease(true);
+
+            // Pause the scanner only while there is something to send
+            scan_.update(now, has_traffic());
+
+            // Effect renderers run on the main loop, whichever task advertises
+            render_effect(now);
+
+            // The advertising task, if running, does the rest independently of the main loop. Without it
+            // the advertiser is stepped from here, so keep loop() spinning while anything is on air
+            if (adv_task_ == nullptr)
+            {
+                if (has_traffic())
+                    high_freq_.start();
+                else
+                    high_freq_.stop();
+                run_advertiser(now);
+            }
+        }
+
+        void FastconController::save_state(bool force)
+        {
+            if (!this->state_store_.enabled())
+                return;
+
+            // A periodic check skips a round while the consumer is busy; shutdown waits for it
+            std::unique_lock<std::mutex> lock(consumer_mutex_, std::defer_lock);
+            if (force)
+                lock.lock();
+            else if (!lock.try_lock())
+                return;
+            if (force)
+                this->state_store_.update_sequence(sequence_, true);
+            const bool lights = this->state_store_.update_lights(millis(), light_states_, force);
+            lock.unlock();
+
+            if (lights && !this->state_store_.save_lights())
+                ESP_LOGW(TAG, "Saving the light states failed");
+            if (force)
+                this->save_lease(false);
+        }
+
+        void FastconController::save_lease(bool sync)
+        {
+            // The old lease runs out within SEQUENCE_LEASE / 2 packets; the new one must be in flash by
+            // then, not after the flash write interval, or a power loss reuses sequence numbers
+            if (!this->state_store_.save_sequence())
+                ESP_LOGW(TAG, "Saving the sequence number failed");
+            else if (sync)
+                global_preferences->sync();
+        }
+
+        void FastconController::stop_extended_sets()
+        {
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+            // The sets belong to the consumer; with the advertising task that is not the main loop
+            if (adv_task_ != nullptr)
+            {
+                stop_sets_requested_ = true;
+                xTaskNotifyGive(adv_task_);
+            }
+            else
+                this->ext_adv_.stop_all();
+#endif
+        }
+
+        void FastconController::on_shutdown()
+        {
+            this->stop_extended_sets();
+            if (!this->state_store_.enabled())
+                return;
+            this->save_state(true);
+            // Written now, ahead of the restart
+            global_preferences->sync();
+        }
+
+        bool FastconController::has_traffic() const
+        {
+            if (pairing_mode_ || !is_queue_empty() || effect_renderer_ || adv_state_ != AdvertiseState::IDLE)
+                return true;
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+            if (this->ext_adv_.busy())
+                return true;
+#endif
+            return false;
+        }
+
+        void FastconController::run_advertiser(uint32_t now)
+        {
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+            if (this->ext_adv_.num_sets() > 0)
+            {
+                loop_extended(now);
+                return;
+            }
+#endif
+
+            // Normal operation - Bluedroid runs GAP calls in order, so each step advances as soon as its call
+            // is accepted; completion events only report errors. A zero gap starts the next packet at once
+            if (adv_state_ == AdvertiseState::ADVERTISING && adv_time_left(now) <= 0)
+            {
+                esp_err_t err = esp_ble_gap_stop_advertising();
+                if (err != ESP_OK)
+                    ESP_LOGW(TAG, "Error stopping advertisement (err=%d): %s", err, esp_err_to_name(err));
+                adv_state_ = AdvertiseState::GAP;
+                state_start_time_ = now;
+                arm_adv_timer(current_gap_);
+                ESP_LOGV(TAG, "Stopped advertising, entering gap period");
+            }
+            if (adv_state_ == AdvertiseState::GAP && adv_time_left(now) <= 0)
+                adv_state_ = AdvertiseState::IDLE;
+            if (adv_state_ == AdvertiseState::IDLE)
+                begin_advertisement();
+        }
+
+        int32_t FastconController::adv_time_left(uint32_t now) const
+        {
+            const uint32_t length = adv_state_ == AdvertiseState::ADVERTISING ? current_duration_.load() : current_gap_.load();
+            return static_cast<int32_t>(length - (now - state_start_time_));
+        }
+
+        void FastconController::arm_adv_timer(uint32_t ms)
+        {
+            // Only the advertising task can be woken; the main loop polls at high frequency instead
+            if (adv_task_ == nullptr)
+                return;
+            esp_err_t err = esp_timer_start_once(adv_timer_, static_cast<uint64_t>(ms) * 1000);
+            if (err != ESP_OK)
+                ESP_LOGW(TAG, "Error starting advertising timer: %s", esp_err_to_name(err));
+        }
+
+        bool FastconController::begin_advertisement()
+        {
+            // Held back while the scanner has its window
+            if (!scan_.advertising_allowed())
+                return false;
+
+            uint8_t adv_data_raw[MAX_PACKET_SIZE] = {0};
+            size_t adv_data_len;
+            uint16_t duration, gap;
+            if (!next_advertisement(adv_data_raw, adv_data_len, duration, gap))
+                return false;
+
+            esp_err_t err = esp_ble_gap_config_adv_data_raw(adv_data_raw, adv_data_len);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Error setting raw advertisement data (err=%d): %s", err, esp_err_to_name(err));
+                return false;
+            }
+            // Queued behind the data, so the new packet is the one that goes on air
+            err = esp_ble_gap_start_advertising(&adv_params_);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Error starting advertisement (err=%d): %s", err, esp_err_to_name(err));
+                return false;
+            }
+
+            current_duration_ = duration;
+            current_gap_ = gap;
+            state_start_time_ = millis();
+            adv_state_ = AdvertiseState::ADVERTISING;
+            arm_adv_timer(duration);
+            metrics_.record_advertisement(duration);
+            ESP_LOGV(TAG, "Started advertising");
+            return true;
+        }
+
+        void FastconController::gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+        {
+            scan_.on_gap_event(event, param);
+            if (event == ESP_GAP_BLE_SCAN_RESULT_EVT && param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT)
             {
-                ESP_LOGW(TAG, "Command queue full (size=%d), dropping command for light %d",
-                         queue_.size(), light_id_);
+                const uint8_t *adv = param->scan_rst.ble_adv;
+                const size_t len = param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len;
+                if (!shard_.on_advertisement(adv, len, millis()))
+                    on_mesh_packet(adv, len);
                 return;
             }
 
-            Command cmd;
-            cmd.data = data;
-            cmd.timestamp = millis();
-            cmd.retries = 0;
+            switch (event)
+            {
+            // The advertising step does not wait for these; a failure costs one packet
+            case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
+                if (param->adv_data_raw_cmpl.status != ESP_BT_STATUS_SUCCESS)
+                    ESP_LOGW(TAG, "Setting advertisement data failed (status=%d)", param->adv_data_raw_cmpl.status);
+                break;
 
-            queue_.push(cmd);
-            ESP_LOGV(TAG, "Command queued, queue size: %d", queue_.size());
-        }
+            case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+                if (param->adv_start_cmpl.status != ESP_BT_STATUS_SUCCESS)
+                    ESP_LOGW(TAG, "Starting advertisement failed (status=%d)", param->adv_start_cmpl.status);
+                break;
 
-        void FastconController::clear_queue()
-        {
-            std::lock_guard<std::mutex> lock(queue_mutex_);
-            std::queue<Command> empty;
-            std::swap(queue_, empty);
+            case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+                if (param->adv_stop_cmpl.status != ESP_BT_STATUS_SUCCESS)
+                    ESP_LOGW(TAG, "Stopping advertisement failed (status=%d)", param->adv_stop_cmpl.status);
+                break;
+
+            default:
+                break;
+            }
         }
 
-        void FastconController::setup()
+        void FastconController::on_adv_timer()
         {
-            ESP_LOGCONFIG(TAG, "Setting up Fastcon BLE Controller...");
-            ESP_LOGCONFIG(TAG, "  Advertisement interval: %d-%d", this->adv_interval_min_, this->adv_interval_max_);
-            ESP_LOGCONFIG(TAG, "  Advertisement duration: %dms", this->adv_duration_);
-            ESP_LOGCONFIG(TAG, "  Advertisement gap: %dms", this->adv_gap_);
+            // Runs in the esp_timer task on its small shared stack: only wake the advertising task, which
+            // does the stopping and encoding
+            if (adv_task_ != nullptr)
+                xTaskNotifyGive(adv_task_);
         }
 
-        void FastconController::loop()
+        void FastconController::on_mesh_packet(const uint8_t *adv, size_t len)
         {
-            const uint32_t now = millis();
+            // Runs on the main loop (ESP32BLE dispatches GAP events from its loop()): decode only, the
+            // consumer applies the result
+            size_t payload_len;
+            const uint8_t *payload = find_manufacturer_data(adv, len, MANUFACTURER_DATA_ID, payload_len);
+            if (payload == nullptr)
+                return;
 
-            // Handle pairing mode - this takes priority over normal operations
-            if (pairing_mode_)
-            {
-                uint32_t elapsed = now - pairing_start_time_;
-                
-                // Phase transition: Discovery (4s) -> Pairing (continues until timeout)
-                if (pairing_phase_ == PairingPhase::DISCOVERY && elapsed >= 4000)
-                {
-                    ESP_LOGI(TAG, "Discovery phase complete - switching to PAIRING phase");
-                    ESP_LOGI(TAG, "Will now broadcast pairing packets with Light ID %d", pairing_light_id_);
-                    pairing_phase_ = PairingPhase::PAIRING;
-                    pairing_phase_start_ = now;  // Track when we entered pairing phase
-                    // Force new advertisement by resetting state
-                    esp_ble_gap_stop_advertising();
-                    adv_state_ = AdvertiseState::IDLE;
-                }
-                
-                // Auto-increment Light ID every 5 seconds during pairing phase
-                if (pairing_phase_ == PairingPhase::PAIRING)
-                {
-                    uint32_t phase_elapsed = now - pairing_phase_start_;
-                    uint32_t current_light_slot = phase_elapsed / 5000;
-                    uint32_t new_light_id = pairing_base_light_id_ + current_light_slot;  // Calculate from base ID
-                    
-                    // Check if we've moved to a new Light ID slot
-                    if (new_light_id != pairing_light_id_)
-                    {
-                        pairing_light_id_ = new_light_id;
-                        ESP_LOGI(TAG, "Auto-incrementing to Light ID %d", pairing_light_id_);
-                        sequence_counter_ = 0x50;  // Reset sequence for new Light ID
-                        esp_ble_gap_stop_advertising();
-                        adv_state_ = AdvertiseState::IDLE;
-                    }
-                }
-                
-                // Exit pairing mode after 60 seconds total
-                if (elapsed >= 60000)
-                {
-                    ESP_LOGI(TAG, "Pairing timeout (60s) - exiting pairing mode");
-                    pairing_mode_ = false;
-                    esp_ble_gap_stop_advertising();
-                    adv_state_ = AdvertiseState::IDLE;
-                    
-                    // Restart BLE scanning
-                    ESP_LOGI(TAG, "Restarting BLE scanner");
-                    esp_ble_gap_start_scanning(300);  // Resume scanning
-                    return;
-                }
-                
-                // Continuously advertise during pairing mode
-                if (adv_state_ == AdvertiseState::IDLE || 
-                    (adv_state_ == AdvertiseState::ADVERTISING && (now - state_start_time_ >= 100)))
-                {
-                    // Stop previous advertisement if any
-                    if (adv_state_ == AdvertiseState::ADVERTISING)
-                    {
-                        esp_ble_gap_stop_advertising();
-                    }
-                    
-                    // Build the appropriate advertisement based on phase
-                    std::vector<uint8_t> adv_data;
-                    if (pairing_phase_ == PairingPhase::DISCOVERY)
-                    {
-                        adv_data = build_discovery_advertisement();
-                        ESP_LOGD(TAG, "Broadcasting discovery advertisement (0x4e)");
-                    }
-                    else
-                    {
-                        adv_data = build_pairing_advertisement();
-                        ESP_LOGD(TAG, "Broadcasting pairing advertisement (0x6e) with Light ID %d", pairing_light_id_);
-                    }
-                    
-                    // Configure BLE advertisement parameters for rapid pairing broadcasts
-                    esp_ble_adv_params_t adv_params = {
-                        .adv_int_min = 0x20,  // 20ms minimum
-                        .adv_int_max = 0x40,  // 40ms maximum - very fast for pairing
-                        .adv_type = ADV_TYPE_NONCONN_IND,
-                        .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
-                        .peer_addr = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                        .peer_addr_type = BLE_ADDR_TYPE_PUBLIC,
-                        .channel_map = ADV_CHNL_ALL,
-                        .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
-                    };
-                    
-                    // Set the raw advertisement data (skip MAC bytes, start from AD flags)
-                    uint8_t adv_data_raw[31] = {0};
-                    size_t copy_len = std::min(adv_data.size() - 6, (size_t)25);  // Skip 6-byte MAC, limit to 25
-                    memcpy(adv_data_raw, adv_data.data() + 6, copy_len);
-                    
-                    esp_err_t err = esp_ble_gap_config_adv_data_raw(adv_data_raw, copy_len);
-                    if (err != ESP_OK)
-                    {
-                        ESP_LOGW(TAG, "Error setting pairing advertisement data: %s", esp_err_to_name(err));
-                        return;
-                    }
-                    
-                    err = esp_ble_gap_start_advertising(&adv_params);
-                    if (err != ESP_OK)
-                    {
-                        ESP_LOGW(TAG, "Error starting pairing advertisement: %s", esp_err_to_name(err));
-                        return;
-                    }
-                    
-                    adv_state_ = AdvertiseState::ADVERTISING;
-                    state_start_time_ = now;
-                }
-                
-                // Keep advertising during pairing mode
+            // Fastcon senders (this one included, see write_adv_frame()) declare the manufacturer data one byte
+            // short, so the last CRC byte follows the field when the advertisement has room for it
+            uint8_t body[MAX_COMMAND_BODY_SIZE];
+            size_t body_len;
+            const uint8_t *addr = DEFAULT_BLE_FASTCON_ADDRESS.data();
+            const size_t addr_len = DEFAULT_BLE_FASTCON_ADDRESS.size();
+            const bool parsed = (payload + payload_len < adv + len &&
+                                 parse_payload(payload, payload_len + 1, addr, addr_len, body, sizeof(body), body_len)) ||
+                                parse_payload(payload, payload_len, addr, addr_len, body, sizeof(body), body_len);
+
+            DecodedCommand decoded;
+            if (!parsed || !decode_command(body, body_len, mesh_key_, decoded) || decoded.type != 5 || decoded.data.empty())
                 return;
-            }
 
-            // Normal operation - handle advertisement state machine
-            switch (adv_state_)
-            {
-            case AdvertiseState::IDLE:
+            Command cmd;
+            cmd.op = CommandOp::RECEIVED;
+            cmd.priority = CommandPriority::EFFECT;
+            cmd.timestamp = millis();
+            cmd.target = 0;
+            uint8_t data[1 + MAX_LIGHT_DATA_SIZE] = {decoded.sequence};
+            size_t data_len = 1;
+
+            // A single-light control record carries that light's new state
+            const uint8_t *record = decoded.data.data();
+            const size_t light_len = (record[0] >> 4) - 1;
+            if ((record[0] & 0x0f) == CONTROL_TYPE_SINGLE && decoded.data.size() >= 2 && light_len >= 1 &&
+                light_len <= MAX_LIGHT_DATA_SIZE && control_record_size(light_len) <= decoded.data.size())
             {
-                std::lock_guard<std::mutex> lock(queue_mutex_);
-                if (queue_.empty())
-                    return;
+                cmd.target = light_target(record[1] | (decoded.addr_high << 8));
+                memcpy(data + 1, record + 2, light_len);
+                data_len += light_len;
+            }
+            cmd.data.assign(data, data_len);
 
-                Command cmd = queue_.front();
-                queue_.pop();
-
-                esp_ble_adv_params_t adv_params = {
-                    .adv_int_min = adv_interval_min_,
-                    .adv_int_max = adv_interval_max_,
-                    .adv_type = ADV_TYPE_NONCONN_IND,
-                    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
-                    .peer_addr = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-                    .peer_addr_type = BLE_ADDR_TYPE_PUBLIC,
-                    .channel_map = ADV_CHNL_ALL,
-                    .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
-                };
-
-                uint8_t adv_data_raw[31] = {0};
-                uint8_t adv_data_len = 0;
-
-                // Add flags
-                adv_data_raw[adv_data_len++] = 2;
-                adv_data_raw[adv_data_len++] = ESP_BLE_AD_TYPE_FLAG;
-                adv_data_raw[adv_data_len++] = ESP_BLE_ADV_FLAG_BREDR_NOT_SPT | ESP_BLE_ADV_FLAG_GEN_DISC;
-
-                // Add manufacturer data
-                adv_data_raw[adv_data_len++] = cmd.data.size() + 2;
-                adv_data_raw[adv_data_len++] = ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE;
-                adv_data_raw[adv_data_len++] = MANUFACTURER_DATA_ID & 0xFF;
-                adv_data_raw[adv_data_len++] = (MANUFACTURER_DATA_ID >> 8) & 0xFF;
-
-                memcpy(&adv_data_raw[adv_data_len], cmd.data.data(), cmd.data.size());
-                adv_data_len += cmd.data.size();
-
-                esp_err_t err = esp_ble_gap_config_adv_data_raw(adv_data_raw, adv_data_len);
-                if (err != ESP_OK)
-                {
-                    ESP_LOGW(TAG, "Error setting raw advertisement data (err=%d): %s", err, esp_err_to_name(err));
-                    return;
-                }
+            // Dropped silently when the inbox is full; a missed relay only costs a repeat
+            if (inbox_.push(cmd) && adv_task_ != nullptr)
+                xTaskNotifyGive(adv_task_);
+        }
 
-                err = esp_ble_gap_start_advertising(&adv_params);
-                if (err != ESP_OK)
-                {
-                    ESP_LOGW(TAG, "Error starting advertisement (err=%d): %s", err, esp_err_to_name(err));
-                    return;
-                }
+        void FastconController::record_latency(const Command &cmd, uint32_t now)
+        {
+            // Repeats and retransmissions were on air before; only a first transmission measures queueing
+            if (cmd.retries == 0)
+                metrics_.record_latency(now - cmd.timestamp);
+        }
 
-                adv_state_ = AdvertiseState::ADVERTISING;
-                state_start_time_ = now;
-                ESP_LOGV(TAG, "Started advertising");
-                break;
-            }
+        void FastconController::publish_metrics()
+        {
+            const ControllerMetrics::Snapshot snapshot = metrics_.take(millis());
+            if (snapshot.elapsed == 0)
+                return;
 
-            case AdvertiseState::ADVERTISING:
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+            char histogram[ControllerMetrics::LATENCY_BUCKETS * 16];
+            size_t pos = 0;
+            for (size_t i = 0; i < ControllerMetrics::LATENCY_BUCKETS && pos < sizeof(histogram); i++)
             {
-                if (now - state_start_time_ >= adv_duration_)
-                {
-                    esp_ble_gap_stop_advertising();
-                    adv_state_ = AdvertiseState::GAP;
-                    state_start_time_ = now;
-                    ESP_LOGV(TAG, "Stopped advertising, entering gap period");
-                }
-                break;
+                if (i < ControllerMetrics::LATENCY_BUCKETS - 1)
+                    pos += snprintf(histogram + pos, sizeof(histogram) - pos, " <=%d:%d", ControllerMetrics::bucket_limit(i),
+                                    snapshot.latency_histogram[i]);
+                else
+                    pos += snprintf(histogram + pos, sizeof(histogram) - pos, " >%d:%d", ControllerMetrics::bucket_limit(i - 1),
+                                    snapshot.latency_histogram[i]);
             }
+            ESP_LOGD(TAG, "Latency histogram (ms, %d commands):%s", snapshot.latency_count, histogram);
+#endif
+
+#ifdef USE_SENSOR
+            const bool sent = snapshot.latency_count > 0;
+            if (this->command_latency_sensor_ != nullptr)
+                this->command_latency_sensor_->publish_state(sent ? static_cast<float>(snapshot.latency_sum) / snapshot.latency_count : NAN);
+            if (this->command_latency_p95_sensor_ != nullptr)
+                this->command_latency_p95_sensor_->publish_state(sent ? snapshot.latency_percentile(95) : NAN);
+            if (this->command_latency_max_sensor_ != nullptr)
+                this->command_latency_max_sensor_->publish_state(sent ? snapshot.latency_max : NAN);
+            if (this->queue_high_water_sensor_ != nullptr)
+                this->queue_high_water_sensor_->publish_state(snapshot.queue_high_water);
+            if (this->dropped_commands_sensor_ != nullptr)
+                this->dropped_commands_sensor_->publish_state(snapshot.dropped);
+            if (this->coalesced_commands_sensor_ != nullptr)
+                this->coalesced_commands_sensor_->publish_state(snapshot.coalesced);
+            if (this->duplicate_states_sensor_ != nullptr)
+                this->duplicate_states_sensor_->publish_state(snapshot.duplicates);
+            if (this->packets_per_second_sensor_ != nullptr)
+                this->packets_per_second_sensor_->publish_state(snapshot.packets * 1000.0f / snapshot.elapsed);
+            // Advertising sets in parallel share one radio, so on-air time beyond the interval is capped
+            if (this->duty_cycle_sensor_ != nullptr)
+                this->duty_cycle_sensor_->publish_state(std::min(100.0f, snapshot.air_time * 100.0f / snapshot.elapsed));
+#endif
+        }
+
+        void FastconController::record_sent(uint8_t sequence, const Command &cmd)
+        {
+            packet_relay_time_ = std::max(packet_relay_time_, relay_time(cmd.target));
+
+            // Only light states are retransmitted; raw and reset commands would just evict them from the table.
+            // While the scanner is paused for our traffic the relays go unheard, so a missing ack would
+            // only trigger blind repeats
+            if (cmd.op != CommandOp::STATE || scan_.scan_paused())
+                return;
 
-            case AdvertiseState::GAP:
+            // Group and member packets override each other, so a late retransmission must not undo a newer one
+            const uint32_t id = cmd.target & ~TARGET_GROUP_FLAG;
+            if (cmd.target & TARGET_GROUP_FLAG)
             {
-                if (now - state_start_time_ >= adv_gap_)
+                for (size_t light_id = 1; light_id < light_groups_.size(); light_id++)
                 {
-                    adv_state_ = AdvertiseState::IDLE;
-                    ESP_LOGV(TAG, "Gap period complete");
+                    if (light_groups_[light_id] == id)
+                        inflight_.remove(light_target(light_id));
                 }
-                break;
             }
+            else if (id < light_groups_.size() && light_groups_[id] != 0)
+            {
+                inflight_.remove(group_target(light_groups_[id]));
             }
+
+            // Exponential back-off: ack_timeout, then twice that, ...
+            const uint32_t now = millis();
+            inflight_.add(sequence, cmd, now, now + (static_cast<uint32_t>(ack_timeout_) << cmd.retries));
         }
 
-        std::vector<uint8_t> FastconController::get_light_data(light::LightState *state)
+        bool FastconController::forwarded(const Command &cmd) const
         {
-            std::vector<uint8_t> light_data = {
-                0, // 0 - On/Off Bit + 7-bit Brightness
-                0, // 1 - Blue byte
-                0, // 2 - Red byte
-                0, // 3 - Green byte
-                0, // 4 - Warm byte
-                0  // 5 - Cold byte
-            };
-
-            // TODO: need to figure out when esphome is changing to white vs setting brightness
+            return cmd.op != CommandOp::STATE || (cmd.target & TARGET_GROUP_FLAG) || cmd.target >= light_groups_.size() ||
+                   !timing_.direct(cmd.target);
+        }
 
-            auto values = state->current_values;
+        uint16_t FastconController::relay_time(uint32_t target) const
+        {
+            const uint32_t id = target & ~TARGET_GROUP_FLAG;
+            if (!(target & TARGET_GROUP_FLAG))
+                return id < light_groups_.size() ? timing_.relay_time(id) : 0;
 
-            bool is_on = values.is_on();
-            if (!is_on)
+            // A group packet has arrived once it has reached its farthest member
+            uint16_t time = 0;
+            for (size_t light_id = 1; light_id < light_groups_.size(); light_id++)
             {
-                return std::vector<uint8_t>({0x00});
+                if (light_groups_[light_id] == id)
+                    time = std::max(time, timing_.relay_time(light_id));
             }
+            return time;
+        }
 
-            auto color_mode = values.get_color_mode();
-            bool has_white = (static_cast<uint8_t>(color_mode) & static_cast<uint8_t>(light::ColorCapability::WHITE)) != 0;
-            float brightness = std::min(values.get_brightness() * 127.0f, 127.0f); // clamp the value to at most 127
-            light_data[0] = 0x80 + static_cast<uint8_t>(brightness);
-
-            if (has_white)
+        bool FastconController::next_retransmission(uint32_t now, Command &cmd)
+        {
+            while (inflight_.pop_due(now, cmd))
             {
-                return std::vector<uint8_t>({static_cast<uint8_t>(brightness)});
-                // DEBUG: when changing to white mode, this should be the payload:
-                // ff0000007f7f
+                // Raw and system commands are not retried, and without relays to go by a missing ack means
+                // nothing; that includes a scanner paused since the packet went out
+                if (cmd.op != CommandOp::STATE || cmd.retries >= Command::MAX_RETRIES || !acks_expected(now))
+                    continue;
+                cmd.retries++;
+                return true;
             }
+            return false;
+        }
 
-            bool has_rgb = (static_cast<uint8_t>(color_mode) & static_cast<uint8_t>(light::ColorCapability::RGB)) != 0;
-            if (has_rgb)
-            {
-                light_data[1] = static_cast<uint8_t>(values.get_blue() * 255.0f);
-                light_data[2] = static_cast<uint8_t>(values.get_red() * 255.0f);
-                light_data[3] = static_cast<uint8_t>(values.get_green() * 255.0f);
-            }
+        void FastconController::handle_received(const Command &cmd)
+        {
+            const uint8_t sequence = cmd.data.data()[0];
+            const bool has_state = cmd.data.size() > 1;
 
-            bool has_cold_warm = (static_cast<uint8_t>(color_mode) & static_cast<uint8_t>(light::ColorCapability::COLD_WARM_WHITE)) != 0;
-            if (has_cold_warm)
+            // A bulb relaying one of our packets: the mesh has it, so any repeat still owed is wasted air time
+            const size_t acked = inflight_.acknowledge(sequence, has_state ? cmd.target : 0,
+                                                       [this, &cmd, sequence](uint32_t target, uint32_t sent_at)
+                                                       {
+                                                           resend_.remove(target);
+                                                           const int32_t delay = static_cast<int32_t>(cmd.timestamp - sent_at);
+                                                           if (!(target & TARGET_GROUP_FLAG) && target < light_groups_.size() && delay >= 0)
+                                                               timing_.learn(target, delay);
+                                                           ESP_LOGV(TAG, "Target 0x%08X acknowledged (seq %d, %dms)", target, sequence, delay);
+                                                       });
+            if (acked > 0)
             {
-                light_data[4] = static_cast<uint8_t>(values.get_warm_white() * 255.0f);
-                light_data[5] = static_cast<uint8_t>(values.get_cold_white() * 255.0f);
+                ack_heard_ = true;
+                last_ack_ = cmd.timestamp;
+                return;
             }
+            if (!has_state || cmd.target >= light_states_.size())
+                return;
+
+            // Sent by someone else (phone app, remote, another node): the light now has this state
+            light_states_[cmd.target].set(cmd.data.data() + 1, cmd.data.size() - 1);
+            ESP_LOGV(TAG, "Learned state of light %d from the mesh (seq %d)", cmd.target, sequence);
+            notify_light_seen(cmd.target);
+        }
+
+        std::vector<uint8_t> FastconController::get_light_data(light::LightState *state)
+        {
+            return this->get_light_data(state->current_values);
+        }
+
+        std::vector<uint8_t> FastconController::get_light_data(const light::LightColorValues &values)
+        {
+            // Any color mode; lights use the encoder specialised for their type instead
+            LightData light_data;
+            encode_light_data<ALL_CAPABILITIES>(values, light_data);
+            return light_data.to_vector();
+        }
 
-            // TODO figure out if we can use these, and how
-            bool has_temp = (static_cast<uint8_t>(color_mode) & static_cast<uint8_t>(light::ColorCapability::COLOR_TEMPERATURE)) != 0;
-            if (has_temp)
+        bool FastconController::encode_control(uint8_t type, uint32_t addr, const uint8_t *light_data, size_t len, PacketBuffer &out,
+                                               bool forward)
+        {
+            std::array<uint8_t, CONTROL_PAYLOAD_SIZE> result_data{};
+            if (write_control_record(result_data.data(), result_data.size(), 0, type, addr, light_data, len) == 0)
             {
-                float temperature = values.get_color_temperature();
-                if (temperature < 153)
-                {
-                    light_data[4] = 0xff;
-                    light_data[5] = 0x00;
-                }
-                else if (temperature > 500)
-                {
-                    light_data[4] = 0x00;
-                    light_data[5] = 0xff;
-                }
-                else
-                {
-                    // Linear interpolation between (153, 0xff) and (500, 0x00)
-                    light_data[4] = (uint8_t)(((500 - temperature) * 255.0f + (temperature - 153) * 0x00) / (500 - 153));
-                    light_data[5] = (uint8_t)(((temperature - 153) * 255.0f + (500 - temperature) * 0x00) / (500 - 153));
-                }
+                ESP_LOGW(TAG, "Light data too large (%d bytes) for address %d", len, addr);
+                out.clear();
+                return false;
             }
 
-            return light_data;
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+            // Debug output - print payload as hex
+            [[maybe_unused]] char hex_str[sizeof(result_data) * 2 + 1];
+            ESP_LOGD(TAG, "Inner Payload (%d bytes): %s", result_data.size(),
+                     bytes_to_hex_string(result_data.data(), result_data.size(), hex_str, sizeof(hex_str)));
+#endif
+
+            return this->generate_command(5, addr, result_data.data(), result_data.size(), out, forward);
         }
 
-        std::vector<uint8_t> FastconController::single_control(uint32_t light_id_, const std::vector<uint8_t> &light_data)
+        bool FastconController::single_control(uint32_t light_id_, const uint8_t *light_data, size_t len, PacketBuffer &out, bool forward)
         {
-            std::vector<uint8_t> result_data(12);
+            return this->encode_control(CONTROL_TYPE_SINGLE, light_id_, light_data, len, out, forward);
+        }
 
-            result_data[0] = 2 | (((0xfffffff & (light_data.size() + 1)) << 4));
-            result_data[1] = light_id_;
-            std::copy(light_data.begin(), light_data.end(), result_data.begin() + 2);
+        std::vector<uint8_t> FastconController::single_control(uint32_t light_id_, const std::vector<uint8_t> &light_data)
+        {
+            PacketBuffer packet;
+            this->single_control(light_id_, light_data.data(), light_data.size(), packet);
+            return packet.to_vector();
+        }
 
-            // Debug output - print payload as hex
-            auto hex_str = vector_to_hex_string(result_data).data();
-            ESP_LOGD(TAG, "Inner Payload (%d bytes): %s", result_data.size(), hex_str);
+        bool FastconController::group_control(uint32_t group_id, const uint8_t *light_data, size_t len, PacketBuffer &out)
+        {
+            return this->encode_control(CONTROL_TYPE_GROUP, group_id, light_data, len, out);
+        }
 
-            return this->generate_command(5, light_id_, result_data, true);
+        std::vector<uint8_t> FastconController::group_control(uint32_t group_id, const std::vector<uint8_t> &light_data)
+        {
+            PacketBuffer packet;
+            this->group_control(group_id, light_data.data(), light_data.size(), packet);
+            return packet.to_vector();
         }
 
-        void FastconController::send_raw_command(uint32_t light_id, const std::vector<uint8_t> &data)
+        void FastconController::add_group_member(uint8_t group_id, uint8_t light_id)
         {
-            // Generate mesh packet with command type 5 (control)
-            std::vector<uint8_t> mesh_packet = generate_command(5, light_id, data, true);
-            queueCommand(light_id, mesh_packet);
+            light_groups_[light_id] = group_id;
         }
 
-        std::vector<uint8_t> FastconController::generate_command(uint8_t n, uint32_t light_id_, const std::vector<uint8_t> &data, bool forward)
+        bool FastconController::collapse_group(Command &cmd)
         {
-            static uint8_t sequence = 0;
+            // Only light state updates can be merged, and only for lights in a known group
+            if (cmd.priority != CommandPriority::NORMAL || cmd.op != CommandOp::STATE || (cmd.target & TARGET_GROUP_FLAG) ||
+                cmd.target >= light_groups_.size())
+                return false;
 
-            // Create command body with header
-            std::vector<uint8_t> body(data.size() + 4);
-            uint8_t i2 = (light_id_ / 256);
+            uint8_t group_id = light_groups_[cmd.target];
+            if (group_id == 0)
+                return false;
 
-            // Construct header
-            body[0] = (i2 & 0b1111) | ((n & 0b111) << 4) | (forward ? 0x80 : 0);
-            body[1] = sequence++; // Use and increment sequence number
-            if (sequence >= 255)
-                sequence = 1;
+            // A group packet changes every member, so every other member must have the identical state pending
+            size_t members = 1;
+            for (size_t light_id = 0; light_id < light_groups_.size(); light_id++)
+            {
+                if (light_groups_[light_id] != group_id || light_id == cmd.target)
+                    continue;
 
-            body[2] = this->mesh_key_[3]; // Safe key
+                const Command *pending = queue_.find(light_target(light_id));
+                if (pending == nullptr || pending->priority != CommandPriority::NORMAL || pending->op != CommandOp::STATE ||
+                    pending->data != cmd.data)
+                    return false;
+                members++;
+            }
 
-            // Copy data
-            std::copy(data.begin(), data.end(), body.begin() + 4);
+            if (members < 2)
+                return false;
 
-            // Calculate checksum
-            uint8_t checksum = 0;
-            for (size_t i = 0; i < body.size(); i++)
+            for (size_t light_id = 0; light_id < light_groups_.size(); light_id++)
             {
-                if (i != 3)
-                {
-                    checksum = checksum + body[i];
-                }
+                if (light_groups_[light_id] == group_id && light_id != cmd.target)
+                    queue_.remove(light_target(light_id));
             }
-            body[3] = checksum;
 
-            // Encrypt header and data
-            for (size_t i = 0; i < 4; i++)
+            cmd.target = group_target(group_id);
+            ESP_LOGD(TAG, "Collapsed %d pending light commands into one packet for group %d", members, group_id);
+            return true;
+        }
+
+        // Control record type and address of a state command, if it can share a packet with others
+        static bool batch_record(const Command &cmd, uint8_t &type, uint8_t &addr)
+        {
+            uint32_t id = cmd.target & ~TARGET_GROUP_FLAG;
+            if (cmd.priority != CommandPriority::NORMAL || cmd.op != CommandOp::STATE || cmd.data.empty() || id > 0xFF)
+                return false;
+
+            type = (cmd.target & TARGET_GROUP_FLAG) ? CONTROL_TYPE_GROUP : CONTROL_TYPE_SINGLE;
+            addr = id;
+            return true;
+        }
+
+        bool FastconController::batch_commands(const Command &first, bool burst, PacketBuffer &out)
+        {
+            uint8_t type, addr;
+            if (max_batch_size_ <= 1 || !batch_record(first, type, addr))
+                return false;
+
+            std::array<uint8_t, CONTROL_PAYLOAD_SIZE> result_data{};
+            size_t used = write_control_record(result_data.data(), result_data.size(), 0, type, addr, first.data.data(), first.data.size());
+            if (used == 0)
+                return false;
+
+            // Drain further pending states whose records still fit in the control payload
+            auto fits = [&](const Command &c)
             {
-                body[i] = DEFAULT_ENCRYPT_KEY[i & 3] ^ body[i];
+                uint8_t t, a;
+                return batch_record(c, t, a) && used + control_record_size(c.data.size()) <= result_data.size();
+            };
+
+            uint8_t count = 1;
+            Command next;
+            while (count < max_batch_size_ && queue_.pop_matching(fits, next))
+            {
+                batch_record(next, type, addr);
+                used = write_control_record(result_data.data(), result_data.size(), used, type, addr, next.data.data(), next.data.size());
+                if (burst)
+                    schedule_repeat(next);
+                remember_state(next);
+                record_latency(next, millis());
+                // Shares the sequence number the packet is about to be encoded with
+                record_sent(sequence_, next);
+                count++;
             }
 
-            for (size_t i = 0; i < data.size(); i++)
+            if (count == 1)
+                return false;
+
+            if (!this->generate_command(5, 0, result_data.data(), result_data.size(), out, true))
+                return false;
+
+            ESP_LOGD(TAG, "Packed %d light commands into one advertisement (%d/%d bytes)", count, used, result_data.size());
+            return true;
+        }
+
+        void FastconController::send_raw_command(uint32_t light_id, const std::vector<uint8_t> &data)
+        {
+            queueCommand(light_id, CommandOp::RAW, data.data(), data.size(), CommandPriority::EFFECT);
+        }
+
+        bool FastconController::generate_command(uint8_t n, uint32_t light_id_, const uint8_t *data, size_t len, PacketBuffer &out, bool forward)
+        {
+            if (len > MAX_COMMAND_DATA_SIZE)
             {
-                body[4 + i] = this->mesh_key_[i & 3] ^ body[4 + i];
+                ESP_LOGW(TAG, "Command data too large (%d bytes, max %d) for light %d", len, MAX_COMMAND_DATA_SIZE, light_id_);
+                out.clear();
+                return false;
             }
 
-            // Prepare the final payload with RF protocol formatting
-            std::vector<uint8_t> addr = {DEFAULT_BLE_FASTCON_ADDRESS.begin(), DEFAULT_BLE_FASTCON_ADDRESS.end()};
-            return prepare_payload(addr, body);
+            const uint8_t sequence = sequence_++; // Use and increment sequence number
+            if (sequence_ >= 255)
+                sequence_ = 1;
+            // Takes a new lease as soon as the stored one runs low; loop() writes it to flash
+            this->state_store_.update_sequence(sequence_);
+
+            return encode_mesh_command(n, light_id_, sequence, this->mesh_key_, data, len, out, forward);
+        }
+
+        std::vector<uint8_t> FastconController::generate_command(uint8_t n, uint32_t light_id_, const std::vector<uint8_t> &data, bool forward)
+        {
+            PacketBuffer packet;
+            this->generate_command(n, light_id_, data.data(), data.size(), packet, forward);
+            return packet.to_vector();
         }
 
-        void FastconController::pair_device(uint32_t new_light_id, uint32_t group_id)
+        void FastconController::pair_device(uint32_t new_light_id)
         {
             // NEW PAIRING PROTOCOL DISCOVERED FROM BLE CAPTURE:
             // The phone/controller advertises with fake MAC 11:22:33:44:55:66
@@ -396,170 +1342,253 @@ namespace esphome
             // 1. Discovery phase (~4 seconds): Command byte 0x4e
             // 2. Pairing phase (~0.3 seconds): Command byte 0x6e with mesh key
             
-            ESP_LOGI(TAG, "=== Starting BLE Pairing Mode for Light ID %d (Group %d) ===", new_light_id, group_id);
-            ESP_LOGI(TAG, "This will broadcast pairing advertisements for 60 seconds");
+            ESP_LOGI(TAG, "=== Starting BLE Pairing Mode for Light ID %d ===", new_light_id);
+            ESP_LOGI(TAG, "This will broadcast pairing advertisements for up to 60 seconds (%d%% of air time while commands are queued)",
+                     pairing_duty_cycle_);
             ESP_LOGI(TAG, "Make sure your light is in factory reset / pairing mode!");
             
-            // CRITICAL: Stop BLE scanning - it blocks advertisements!
-            ESP_LOGI(TAG, "Stopping BLE scanner to enable pairing advertisements");
-            esp_ble_gap_stop_scanning();
-            
-            // Stop any existing advertisements and reset state
-            esp_ble_gap_stop_advertising();
-            
-            // Store pairing state
-            pairing_mode_ = true;
-            pairing_start_time_ = millis();
-            pairing_light_id_ = new_light_id;
-            pairing_base_light_id_ = new_light_id;  // Remember starting ID
-            pairing_phase_ = PairingPhase::DISCOVERY;
-            adv_state_ = AdvertiseState::IDLE;  // CRITICAL: Initialize state for pairing
+            // Scanning blocks advertisements; like queued commands, pairing keeps the scanner paused.
+            // The advertiser reads the pairing state under the consumer lock; pairing packets then take
+            // turns with queued commands from the next advertisement on
+            {
+                std::lock_guard<std::mutex> lock(consumer_mutex_);
+                pairing_start_time_ = millis();
+                pairing_light_id_ = new_light_id;
+                pairing_base_light_id_ = new_light_id;  // Remember starting ID
+                pairing_phase_ = PairingPhase::DISCOVERY;
+                pairing_phase_start_ = pairing_start_time_;
+                pairing_slots_ = 0;
+                pairing_adverts_ = 0;
+                pairing_target_seen_ = false;
+                pairing_mode_ = true;
+            }
+            if (adv_task_ != nullptr)
+                xTaskNotifyGive(adv_task_);
             
-            // We'll handle the actual advertisement in loop()
             ESP_LOGI(TAG, "Pairing mode activated - entering DISCOVERY phase");
         }
 
+        void FastconController::stop_pairing()
+        {
+            if (pairing_mode_)
+                end_pairing("stopped");
+        }
+
+        void FastconController::notify_light_seen(uint32_t light_id)
+        {
+            // May be called from the advertising task; loop() ends pairing on its next pass
+            if (pairing_mode_ && pairing_phase_ == PairingPhase::PAIRING && light_id >= pairing_base_light_id_ &&
+                light_id <= pairing_light_id_)
+                pairing_target_seen_ = true;
+        }
+
+        void FastconController::update_pairing(uint32_t now)
+        {
+            if (pairing_target_seen_.exchange(false))
+            {
+                ESP_LOGI(TAG, "Light ID %d answered - pairing complete", pairing_light_id_.load());
+                end_pairing("target light seen");
+                return;
+            }
+
+            uint32_t elapsed = now - pairing_start_time_;
+
+            // Phase transition: Discovery (4s) -> Pairing (continues until timeout)
+            if (pairing_phase_ == PairingPhase::DISCOVERY && elapsed >= 4000)
+            {
+                ESP_LOGI(TAG, "Discovery phase complete - switching to PAIRING phase");
+                ESP_LOGI(TAG, "Will now broadcast pairing packets with Light ID %d", pairing_light_id_.load());
+                pairing_phase_start_ = now;  // Track when we entered pairing phase
+                pairing_phase_ = PairingPhase::PAIRING;
+            }
+
+            // Auto-increment Light ID every 5 seconds during pairing phase
+            if (pairing_phase_ == PairingPhase::PAIRING)
+            {
+                uint32_t phase_elapsed = now - pairing_phase_start_;
+                uint32_t current_light_slot = phase_elapsed / 5000;
+                uint32_t new_light_id = pairing_base_light_id_ + current_light_slot;  // Calculate from base ID
+
+                // Check if we've moved to a new Light ID slot
+                if (new_light_id != pairing_light_id_)
+                {
+                    pairing_light_id_ = new_light_id;
+                    ESP_LOGI(TAG, "Auto-incrementing to Light ID %d", new_light_id);
+                    sequence_counter_ = 0x50;  // Reset sequence for new Light ID
+                }
+            }
+
+            // Exit pairing mode after 60 seconds total
+            if (elapsed >= 60000)
+                end_pairing("timeout (60s)");
+        }
+
+        void FastconController::end_pairing([[maybe_unused]] const char *reason)
+        {
+            // The scan scheduler resumes scanning once the remaining traffic has settled
+            ESP_LOGI(TAG, "Pairing %s - exiting pairing mode", reason);
+            pairing_mode_ = false;
+            // Pairing broadcasts would otherwise stay on set 0 until their air time runs out
+            this->stop_extended_sets();
+        }
+
+        bool FastconController::take_pairing_slot()
+        {
+            if (!pairing_mode_)
+                return false;
+
+            // With nothing else waiting pairing has the air to itself; otherwise it gets its duty cycle
+            // of the advertisements sent while commands are queued
+            const bool contended = !queue_.empty() || !resend_.empty() || effects_.pending();
+            if (!contended)
+                return true;
+
+            const bool pairing_turn = pairing_adverts_ * 100 < static_cast<uint32_t>(pairing_duty_cycle_) * (pairing_slots_ + 1);
+            pairing_slots_++;
+            if (pairing_turn)
+                pairing_adverts_++;
+            return pairing_turn;
+        }
+
+        size_t FastconController::build_pairing_adv_data(uint8_t *raw)
+        {
+            if (pairing_phase_ == PairingPhase::DISCOVERY)
+            {
+                write_discovery_frame(raw);
+                ESP_LOGV(TAG, "Broadcasting discovery advertisement (0x4e)");
+            }
+            else
+            {
+                write_pairing_frame(raw);
+                ESP_LOGV(TAG, "Broadcasting pairing advertisement (0x6e) with Light ID %d", pairing_light_id_.load());
+            }
+            return PAIRING_ADV_SIZE;
+        }
+
         void FastconController::factory_reset_device(uint32_t light_id)
         {
             ESP_LOGI(TAG, "Sending factory reset to Light ID %d", light_id);
             
-            // Factory reset command: all zeros payload
-            std::vector<uint8_t> reset_data(7, 0x00);
-            
-            // Send reset command
-            std::vector<uint8_t> mesh_packet = generate_command(5, light_id, reset_data, true);
-            queueCommand(light_id, mesh_packet);
+            // Send reset command (encoded when it is transmitted)
+            queueCommand(light_id, CommandOp::FACTORY_RESET, nullptr, 0, CommandPriority::SYSTEM);
             
             ESP_LOGI(TAG, "Factory reset command queued");
         }
 
-        std::vector<uint8_t> FastconController::build_discovery_advertisement()
+        // Pairing advertisements as captured from the app, from the AD flags on:
+        //   02 01 1a            AD flags
+        //   13 ff f0 ff         manufacturer specific data, company 0xfff0 (declared as 19 bytes)
+        //   4e / 6e             command: discovery / pairing
+        // followed by the command's payload and a 3-byte CRC
+
+        // Example from capture: 66554433221102011a13fff0ff4e6c5a05348e89b5e238a1a85e367bc4e9974d
+        static constexpr std::array<uint8_t, FastconController::PAIRING_FRAME_SIZE> DISCOVERY_FRAME = {
+            0x02, 0x01, 0x1a, 0x13, 0xff, 0xf0, 0xff, 0x4e,
+            0x6c, 0x5a, 0x00,                               // Varied by a counter between packets
+            0x34, 0x8e, 0x89, 0xb5,
+            0xe2, 0x38, 0xa1, 0xa8, 0x5e, 0x36, 0x7b, 0xc4, // Placeholder for remaining bytes (we'll improve this later)
+            0xe9, 0x97, 0x4d};                              // CRC - placeholder for now
+        static const size_t DISCOVERY_COUNTER_OFFSET = 8;
+
+        // Example: 66554433221102011a13fff0ff6e50596344103332340a3939303233367cb212
+        // Decoded: nPYcD.324.990236|..
+        static constexpr std::array<uint8_t, FastconController::PAIRING_FRAME_SIZE> PAIRING_FRAME = {
+            0x02, 0x01, 0x1a, 0x13, 0xff, 0xf0, 0xff, 0x6e,
+            0x50,                   // Sequence counter (increments with each packet)
+            0x00, 0x00,             // Light ID, 16-bit little-endian
+            0x44, 0x10, 0x33, 0x32, // Pattern observed in captures
+            0x34, 0x0a,             // "34\n"
+            '9', '9',               // Mesh key prefix
+            0x00, 0x00, 0x00, 0x00, // Mesh key, already ASCII
+            0x00, 0x00, 0x00};      // CRC
+        static const size_t PAIRING_COMMAND_OFFSET = 7;
+        static const size_t PAIRING_SEQUENCE_OFFSET = 8;
+        static const size_t PAIRING_LIGHT_ID_OFFSET = 9;
+        static const size_t PAIRING_MESH_KEY_OFFSET = 19;
+        static const size_t PAIRING_CRC_OFFSET = 23;
+
+        // MAC address (reversed) in front of the captured frames: 11:22:33:44:55:66 -> 66 55 44 33 22 11
+        static const uint8_t PAIRING_MAC[] = {0x66, 0x55, 0x44, 0x33, 0x22, 0x11};
+
+        void FastconController::write_discovery_frame(uint8_t *frame)
         {
-            // Discovery phase advertisement (command 0x4e)
-            // Example from capture: 66554433221102011a13fff0ff4e6c5a05348e89b5e238a1a85e367bc4e9974d
-            
-            std::vector<uint8_t> adv_data;
-            
-            // MAC Address (reversed): 11:22:33:44:55:66 -> 66 55 44 33 22 11
-            adv_data.insert(adv_data.end(), {0x66, 0x55, 0x44, 0x33, 0x22, 0x11});
-            
-            // AD Flags structure
-            adv_data.insert(adv_data.end(), {0x02, 0x01, 0x1a});
-            
-            // Manufacturer Specific Data structure
-            adv_data.push_back(0x13);  // Length: 19 bytes
-            adv_data.push_back(0xff);  // Type: Manufacturer Specific
-            adv_data.push_back(0xf0);  // Company ID: 0xf0ff (little-endian)
-            adv_data.push_back(0xff);
-            
-            // Command byte for discovery
-            adv_data.push_back(0x4e);  // 'N' - discovery mode
-            
-            // Variable data (7 bytes) - using random values for now
+            memcpy(frame, DISCOVERY_FRAME.data(), PAIRING_FRAME_SIZE);
             // These appear to change between packets in the capture
-            static uint8_t counter = 0;
-            adv_data.insert(adv_data.end(), {
-                static_cast<uint8_t>(0x6c + (counter % 4)),
-                static_cast<uint8_t>(0x5a + (counter % 8)),
-                static_cast<uint8_t>(counter % 8),
-                0x34, 0x8e, 0x89, 0xb5
-            });
-            counter++;
-            
-            // Placeholder for remaining bytes (we'll improve this later)
-            adv_data.insert(adv_data.end(), {0xe2, 0x38, 0xa1, 0xa8, 0x5e, 0x36, 0x7b, 0xc4});
-            
-            // CRC (3 bytes) - placeholder for now
-            adv_data.insert(adv_data.end(), {0xe9, 0x97, 0x4d});
-            
-            return adv_data;
+            frame[DISCOVERY_COUNTER_OFFSET] += discovery_counter_ % 4;
+            frame[DISCOVERY_COUNTER_OFFSET + 1] += discovery_counter_ % 8;
+            frame[DISCOVERY_COUNTER_OFFSET + 2] = discovery_counter_ % 8;
+            discovery_counter_++;
         }
 
-        std::vector<uint8_t> FastconController::build_pairing_advertisement()
+        void FastconController::write_pairing_frame(uint8_t *frame)
         {
-            // Pairing phase advertisement (command 0x6e) with mesh key
-            // Example: 66554433221102011a13fff0ff6e50596344103332340a3939303233367cb212
-            // Decoded: nPYcD.324.990236|..
-            
-            std::vector<uint8_t> adv_data;
-            
-            // MAC Address (reversed): 11:22:33:44:55:66 -> 66 55 44 33 22 11
-            adv_data.insert(adv_data.end(), {0x66, 0x55, 0x44, 0x33, 0x22, 0x11});
-            
-            // AD Flags structure
-            adv_data.insert(adv_data.end(), {0x02, 0x01, 0x1a});
-            
-            // Manufacturer Specific Data structure
-            adv_data.push_back(0x13);  // Length: 19 bytes
-            adv_data.push_back(0xff);  // Type: Manufacturer Specific
-            adv_data.push_back(0xf0);  // Company ID: 0xf0ff (little-endian)
-            adv_data.push_back(0xff);
-            
-            // Command byte for pairing
-            adv_data.push_back(0x6e);  // 'n' - pairing mode
-            
-            // Sequence counter (increments with each packet)
-            static uint8_t pairing_counter = 0x50;
-            adv_data.push_back(pairing_counter++);
-            
+            memcpy(frame, PAIRING_FRAME.data(), PAIRING_FRAME_SIZE);
+            frame[PAIRING_SEQUENCE_OFFSET] = sequence_counter_++;
+
             // CRITICAL: Light ID assignment (16-bit little-endian at bytes 2-3)
             // Based on brmesh-pairing.yaml: uint16_t light_id = (mfg_data[7] << 8) | mfg_data[6]
-            // In full packet that's offsets 13+6=19 and 13+7=20, so mfg_data[6-7]
-            // Here in mfg_data it's positions 2-3 after command+counter
-            ESP_LOGD(TAG, "Including Light ID %d (0x%04x) in pairing packet", pairing_light_id_, pairing_light_id_);
-            adv_data.push_back(static_cast<uint8_t>(pairing_light_id_ & 0xFF));        // Low byte
-            adv_data.push_back(static_cast<uint8_t>((pairing_light_id_ >> 8) & 0xFF)); // High byte
-            
-            // Variable data (4 bytes) - pattern observed in captures
-            adv_data.insert(adv_data.end(), {
-                0x44,
-                0x10,
-                0x33,
-                0x32
-            });
-            
-            // Sequence: "34\n" (0x34, 0x0a)
-            adv_data.insert(adv_data.end(), {0x34, 0x0a});
-            
-            // Mesh key in ASCII format: "99" + hex_as_ascii
+            const uint32_t light_id = pairing_light_id_;
+            ESP_LOGV(TAG, "Including Light ID %d (0x%04x) in pairing packet", light_id, light_id);
+            frame[PAIRING_LIGHT_ID_OFFSET] = light_id & 0xFF;
+            frame[PAIRING_LIGHT_ID_OFFSET + 1] = (light_id >> 8) & 0xFF;
+
             // For mesh key 0x30323336 ("0236"), send "990236"
-            adv_data.insert(adv_data.end(), {'9', '9'});  // Prefix
-            
-            // Convert mesh key bytes to ASCII hex representation
-            for (int i = 0; i < 4; i++) {
-                adv_data.push_back(mesh_key_[i]);  // Already ASCII: 0x30='0', 0x32='2', 0x33='3', 0x36='6'
-            }
-            
-            // CRC (3 bytes) - calculate based on payload
-            uint32_t crc = calculate_pairing_crc(adv_data);
-            adv_data.push_back((crc >> 16) & 0xFF);
-            adv_data.push_back((crc >> 8) & 0xFF);
-            adv_data.push_back(crc & 0xFF);
-            
-            std::vector<uint8_t> payload_subset(adv_data.begin() + 9, adv_data.end());
+            memcpy(frame + PAIRING_MESH_KEY_OFFSET, mesh_key_.data(), mesh_key_.size());
+
+            const uint32_t crc = calculate_pairing_crc(frame + PAIRING_COMMAND_OFFSET, PAIRING_CRC_OFFSET - PAIRING_COMMAND_OFFSET);
+            frame[PAIRING_CRC_OFFSET] = (crc >> 16) & 0xFF;
+            frame[PAIRING_CRC_OFFSET + 1] = (crc >> 8) & 0xFF;
+            frame[PAIRING_CRC_OFFSET + 2] = crc & 0xFF;
+
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE
+            std::vector<uint8_t> payload_subset(frame + 3, frame + PAIRING_FRAME_SIZE);
             std::vector<char> hex_chars = vector_to_hex_string(payload_subset);
-            ESP_LOGD(TAG, "Pairing advertisement payload: %s", hex_chars.data());
-            
+            ESP_LOGV(TAG, "Pairing advertisement payload: %s", hex_chars.data());
+#endif
+        }
+
+        std::vector<uint8_t> FastconController::build_discovery_advertisement()
+        {
+            std::vector<uint8_t> adv_data(sizeof(PAIRING_MAC) + PAIRING_FRAME_SIZE);
+            memcpy(adv_data.data(), PAIRING_MAC, sizeof(PAIRING_MAC));
+            write_discovery_frame(adv_data.data() + sizeof(PAIRING_MAC));
+            return adv_data;
+        }
+
+        std::vector<uint8_t> FastconController::build_pairing_advertisement()
+        {
+            std::vector<uint8_t> adv_data(sizeof(PAIRING_MAC) + PAIRING_FRAME_SIZE);
+            memcpy(adv_data.data(), PAIRING_MAC, sizeof(PAIRING_MAC));
+            write_pairing_frame(adv_data.data() + sizeof(PAIRING_MAC));
             return adv_data;
         }
 
         uint32_t FastconController::calculate_pairing_crc(const std::vector<uint8_t> &data)
+        {
+            // Start after manufacturer header
+            const size_t start = sizeof(PAIRING_MAC) + PAIRING_COMMAND_OFFSET;
+            if (data.size() <= start)
+                return 0;
+            return calculate_pairing_crc(data.data() + start, data.size() - start);
+        }
+
+        uint32_t FastconController::calculate_pairing_crc(const uint8_t *payload, size_t len) const
         {
             // CRC calculation - this is a placeholder
             // We need to reverse-engineer the actual algorithm from the captures
             // For now, return a simple checksum-based value
-            
+
             uint32_t sum = 0;
-            for (size_t i = 13; i < data.size(); i++) {  // Start after manufacturer header
-                sum += data[i];
+            for (size_t i = 0; i < len; i++) {
+                sum += payload[i];
             }
-            
+
             // Simple transformation to get 3 bytes
             uint32_t crc = (sum * 0x1234) & 0xFFFFFF;
-            
+
             // TODO: Analyze multiple captures to determine the real CRC algorithm
             ESP_LOGV(TAG, "CRC calculated: 0x%06X (placeholder algorithm)", crc);
-            
+
             return crc;
         }
     } // namespace fastcon
@@ -1,46 +1,131 @@
 #pragma once
 
-#include <queue>
+#include <atomic>
+#include <cmath>
+#include <functional>
 #include <mutex>
 #include <vector>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+#include "esphome/components/esp32_ble/ble.h"
 #include "esphome/components/esp32_ble_server/ble_server.h"
 #include "esphome/components/light/light_state.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#include "command_scheduler.h"
+#include "controller_metrics.h"
+#include "effect_stream.h"
+#include "extended_advertiser.h"
+#include "inflight_table.h"
+#include "light_debouncer.h"
+#include "light_encoder.h"
+#include "mesh_timing.h"
+#include "protocol.h"
+#include "ring_buffer.h"
+#include "scan_scheduler.h"
+#include "shard_map.h"
+#include "state_store.h"
+
+// Set from max_queue_size by the code generator
+#ifndef FASTCON_MAX_QUEUE_SIZE
+#define FASTCON_MAX_QUEUE_SIZE 100
+#endif
 
 namespace esphome
 {
     namespace fastcon
     {
+        static const size_t MAX_QUEUE_SIZE = FASTCON_MAX_QUEUE_SIZE;
 
-        class FastconController : public Component
+        class FastconController : public Component, public esp32_ble::GAPEventHandler
         {
+#ifdef USE_SENSOR
+            // Diagnostic sensors, published every metrics interval
+            SUB_SENSOR(command_latency)
+            SUB_SENSOR(command_latency_p95)
+            SUB_SENSOR(command_latency_max)
+            SUB_SENSOR(queue_high_water)
+            SUB_SENSOR(dropped_commands)
+            SUB_SENSOR(coalesced_commands)
+            SUB_SENSOR(duplicate_states)
+            SUB_SENSOR(packets_per_second)
+            SUB_SENSOR(duty_cycle)
+#endif
+
         public:
             FastconController() = default;
 
             void setup() override;
             void loop() override;
+            // Saves the sequence number and light states before a reboot (OTA, safe mode)
+            void on_shutdown() override;
+
+            // Dispatched from ESP32BLE::loop(): follows the scanner, receives mesh packets and reports
+            // advertising failures
+            void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) override;
 
             std::vector<uint8_t> get_light_data(light::LightState *state);
+            std::vector<uint8_t> get_light_data(const light::LightColorValues &values);
+            // `forward` = false tells the bulbs not to relay the packet (the light is in direct range)
+            bool single_control(uint32_t addr, const uint8_t *light_data, size_t len, PacketBuffer &out, bool forward = true);
             std::vector<uint8_t> single_control(uint32_t addr, const std::vector<uint8_t> &light_data);
+
+            // Control every light paired into `group_id` with a single packet
+            bool group_control(uint32_t group_id, const uint8_t *light_data, size_t len, PacketBuffer &out);
+            std::vector<uint8_t> group_control(uint32_t group_id, const std::vector<uint8_t> &light_data);
+
+            // Register a light as a member of a mesh group so identical pending states can be collapsed
+            void add_group_member(uint8_t group_id, uint8_t light_id);
             
             // Send raw command (for custom effects like music mode)
             void send_raw_command(uint32_t light_id, const std::vector<uint8_t> &data);
 
-            void queueCommand(uint32_t light_id_, const std::vector<uint8_t> &data);
+            // Queue a logical command; it is encoded only when it is transmitted. Safe to call from any
+            // task and never blocks; returns false if the queue is full.
+            bool queueCommand(uint32_t light_id_, CommandOp op, const uint8_t *data, size_t len,
+                              CommandPriority priority = CommandPriority::NORMAL);
+            // Streaming effects (e.g. music mode): `renderer` is called from the main loop `fps` times per
+            // second for every light in `lights`; the latest frame of each light is sent round-robin and
+            // frames that were superseded before their turn are dropped
+            using EffectRenderer = std::function<bool(uint8_t light_id, uint32_t now, CommandData &frame)>;
+            void start_effect(const std::vector<uint8_t> &lights, float fps, EffectRenderer renderer);
+            void stop_effect();
+            // Push the latest frame for a light (from any task), replacing a frame that was not sent yet
+            bool stream_frame(uint8_t light_id, const uint8_t *data, size_t len);
+            bool stream_frame(uint8_t light_id, const std::vector<uint8_t> &data) { return stream_frame(light_id, data.data(), data.size()); }
 
-            void clear_queue();
-            bool is_queue_empty() const
-            {
-                std::lock_guard<std::mutex> lock(queue_mutex_);
-                return queue_.empty();
-            }
-            size_t get_queue_size() const
-            {
-                std::lock_guard<std::mutex> lock(queue_mutex_);
-                return queue_.size();
-            }
-            void set_max_queue_size(size_t size) { max_queue_size_ = size; }
+            // Queue a light state for `target` (light or group); states the light already has are
+            // discarded before they are scheduled. Returns false if the queue is full.
+            bool queue_state(uint32_t target, const LightData &state);
+
+            // Lights keep their debounce state in the controller, which sends it from a single pass in
+            // loop(). add_light() returns the index the light passes to the calls below; `output` and
+            // `encoder` let scenes find and encode the light.
+            uint16_t add_light(uint32_t target, uint16_t debounce, uint16_t min_interval, light::LightOutput *output,
+                               LightEncoder encoder);
+            // Debounced: sent once the light's state has settled and its minimum interval has passed
+            void set_light_state(uint16_t index, const LightData &state);
+            // Queues `state` right away and restarts the light's minimum interval
+            bool send_light_state(uint16_t index, uint32_t target, const LightData &state);
+
+            // Sends the remote values of every light in `lights` at once, bypassing their debounce: lights
+            // of a group that all get the same state share one group packet, the rest are batched
+            void apply_scene(const std::vector<light::LightState *> &lights);
+
+            // Drops every queued command before the next transmission
+            void clear_queue() { clear_requested_ = true; }
+            bool is_queue_empty() const { return get_queue_size() == 0; }
+            size_t get_queue_size() const { return inbox_.size() + scheduled_count_; }
+            // Wait before retransmitting an unacknowledged state; doubles with every attempt
+            void set_ack_timeout(uint16_t timeout) { ack_timeout_ = timeout; }
+            // Number of pending light states that may be packed into one advertisement (1 = no packing)
+            void set_max_batch_size(uint8_t size) { max_batch_size_ = size; }
 
             void set_mesh_key(std::array<uint8_t, 4> key) { mesh_key_ = key; }
             void set_adv_interval_min(uint16_t val) { adv_interval_min_ = val; }
@@ -54,29 +139,153 @@ namespace esphome
             }
             void set_adv_duration(uint16_t val) { adv_duration_ = val; }
             void set_adv_gap(uint16_t val) { adv_gap_ = val; }
+            // Parallel BLE 5 advertising sets; 1 uses the legacy advertising API
+            void set_advertising_sets(uint8_t sets) { advertising_sets_ = sets; }
+            // Run the advertiser in its own task on the Bluetooth host core instead of the main loop
+            void set_advertising_task(bool enabled) { advertising_task_ = enabled; }
+            // Shorten air time to `burst_duration` while at least `burst_queue_depth` commands are
+            // pending and use `idle_duration` when the queue is empty (burst_queue_depth 0 = fixed timing)
+            void set_adaptive_timing(uint8_t burst_queue_depth, uint16_t burst_duration, uint16_t idle_duration, bool resend_final_state)
+            {
+                burst_queue_depth_ = burst_queue_depth;
+                burst_duration_ = burst_duration;
+                idle_duration_ = idle_duration;
+                resend_final_state_ = resend_final_state;
+            }
+
+            // Relay timing: space packets by the time the mesh needs to relay them, estimated from each
+            // light's hop count (`hop_time` per hop) and, if `learn` is set, from the acknowledgements
+            void set_relay_timing(uint16_t hop_time, bool learn) { timing_.configure(hop_time, learn); }
+            // Distance of a light from this controller in relay hops (0 = direct, its packets are not relayed)
+            void set_relay_hops(uint8_t light_id, uint8_t hops) { timing_.set_hops(light_id, hops); }
+            // Share of every second the controller may be on air (100 = no limit)
+            void set_air_time_budget(uint8_t percent) { timing_.set_budget(percent); }
+
+            void set_metrics_interval(uint32_t interval) { metrics_interval_ = interval; }
+            // Resume the sequence number and skip states the lights already have after a restart
+            void set_restore_state(bool enabled) { restore_state_ = enabled; }
+            void set_state_save_interval(uint32_t interval) { state_store_.set_save_interval(interval); }
 
             // Pairing commands
-            void pair_device(uint32_t new_light_id, uint32_t group_id = 1);
+            void pair_device(uint32_t new_light_id);
+            void stop_pairing();
+            // Report that a light answered on the mesh; ends pairing early if it is the light being paired
+            void notify_light_seen(uint32_t light_id);
+            bool is_pairing() const { return pairing_mode_; }
+            // Scanner pause/resume timing (ms, scan duration in seconds)
+            void set_scan_coexistence(uint32_t resume_delay, uint32_t max_pause, uint32_t scan_window, uint32_t scan_duration)
+            {
+                scan_.configure(resume_delay, max_pause, scan_window, scan_duration);
+            }
+            // Transmit only for this node's share of the light IDs when several controllers serve one mesh
+            void set_shard(uint8_t index, uint8_t count, ShardMap::Strategy strategy) { shard_.configure(index, count, strategy); }
+            void set_shard_failover(uint32_t heartbeat_interval, uint32_t timeout) { shard_.set_failover(heartbeat_interval, timeout); }
+            // Share of advertisements given to pairing while other commands are queued (10-100%)
+            void set_pairing_duty_cycle(uint8_t percent) { pairing_duty_cycle_ = percent; }
             void factory_reset_device(uint32_t light_id);
             
-            // Pairing advertisement helpers
+            // Pairing advertisement helpers (MAC address first, as in the captures)
             std::vector<uint8_t> build_discovery_advertisement();
             std::vector<uint8_t> build_pairing_advertisement();
             uint32_t calculate_pairing_crc(const std::vector<uint8_t> &data);
+            // Checksum over the pairing payload, from the command byte to the end of the mesh key
+            uint32_t calculate_pairing_crc(const uint8_t *payload, size_t len) const;
+            // Pairing frame size from the AD flags on; only PAIRING_ADV_SIZE bytes of it are advertised,
+            // leaving out the last CRC byte
+            static const size_t PAIRING_FRAME_SIZE = 26;
+            static const size_t PAIRING_ADV_SIZE = 25;
 
         protected:
-            struct Command
+            bool enqueue(const Command &cmd);
+            // Consumer side: moves commands from the inbox into the scheduler
+            void drain_inbox();
+            void schedule(const Command &cmd);
+            bool encode_control(uint8_t type, uint32_t addr, const uint8_t *light_data, size_t len, PacketBuffer &out,
+                                bool forward = true);
+            bool encode_command(const Command &cmd, PacketBuffer &out);
+            bool collapse_group(Command &cmd);
+            bool batch_commands(const Command &first, bool burst, PacketBuffer &out);
+            // Builds the next advertisement (heartbeat, pairing or command) into `raw`; returns false if there is
+            // nothing to send or the air-time budget is used up. `gap` is the quiet time to leave after it.
+            // Heartbeats and pairing only go out when `broadcasts` is set
+            bool next_advertisement(uint8_t *raw, size_t &len, uint16_t &duration, uint16_t &gap, bool broadcasts = true);
+            // Pops the next command and encodes it (with any commands packed alongside) into `packet`;
+            // consumer_mutex_ must be held
+            bool next_command(PacketBuffer &packet, uint16_t &duration);
+            bool state_is_current(uint32_t target, const CommandData &state) const;
+            void remember_state(const Command &cmd);
+            uint16_t select_duration(size_t depth) const;
+            bool next_effect_frame(PacketBuffer &packet, uint16_t &duration);
+            void flush_lights(uint32_t now);
+            // False for a state sent to a light in direct range, which the bulbs need not relay
+            bool forwarded(const Command &cmd) const;
+            // Time the mesh needs to relay a packet to every light `target` addresses
+            uint16_t relay_time(uint32_t target) const;
+            void render_effect(uint32_t now);
+            void schedule_repeat(const Command &cmd);
+
+            // Instrumentation: counters are recorded wherever the event happens, publish_metrics() reports them
+            void record_latency(const Command &cmd, uint32_t now);
+            void publish_metrics();
+            ControllerMetrics metrics_;
+            uint32_t metrics_interval_{0};
+
+            // sequence_ and light_states_ in flash; save_state() runs on the main loop
+            void save_state(bool force = false);
+            // Writes a lease renewed by the consumer; `sync` pushes it to flash at once
+            void save_lease(bool sync);
+            StateStore state_store_;
+            bool restore_state_{true};
+            // How often the snapshot is compared with the live state
+            static const uint32_t STATE_CHECK_INTERVAL_MS = 1000;
+#ifdef FASTCON_HAS_EXTENDED_ADVERTISING
+            void loop_extended(uint32_t now);
+            ExtendedAdvertiser ext_adv_;
+            // Set from the main loop while the advertising task owns the sets; it stops them next pass
+            std::atomic<bool> stop_sets_requested_{false};
+#endif
+            // Takes every extended advertising set off the air (pairing end, shutdown)
+            void stop_extended_sets();
+
+            // Producers push into the lock-free inbox; the scheduler, resend list and state cache below
+            // are only touched by the consumer (whoever holds consumer_mutex_). The mutex is never
+            // taken by producers and never held across a BLE call.
+            MpscRingBuffer<Command, ring_capacity(MAX_QUEUE_SIZE)> inbox_;
+            std::atomic<bool> clear_requested_{false};
+            // A stop_effect() that found the inbox full
+            std::atomic<bool> stream_stop_requested_{false};
+            std::atomic<size_t> scheduled_count_{0};
+            std::mutex consumer_mutex_;
+            CommandScheduler queue_;
+            // Final states sent with burst timing, repeated once the queue drains
+            CommandScheduler resend_;
+            // Streaming effect frames; alternates with queued commands while both have work
+            EffectStream effects_;
+            bool effect_turn_{true};
+            uint8_t max_batch_size_{1};
+
+            // Mesh group of each light ID (0 = not in a known group)
+            std::array<uint8_t, 256> light_groups_{};
+            // Last state transmitted to each light ID
+            std::array<CachedLightState, 256> light_states_{};
+
+            // Debounce state of every light; main loop only
+            LightDebouncer lights_;
+            // Output and encoder of each light, by debounce table index
+            struct SceneLight
             {
-                std::vector<uint8_t> data;
-                uint32_t timestamp;
-                uint8_t retries{0};
-                static constexpr uint8_t MAX_RETRIES = 3;
+                light::LightOutput *output;
+                LightEncoder encoder;
             };
+            std::vector<SceneLight> scene_lights_;
 
-            std::queue<Command> queue_;
-            mutable std::mutex queue_mutex_;
-            size_t max_queue_size_{100};
+            // Main loop side of the streaming effect
+            EffectRenderer effect_renderer_;
+            std::vector<uint8_t> effect_lights_;
+            uint32_t effect_interval_ms_{50};
+            uint32_t last_effect_frame_{0};
 
+            // IDLE -> ADVERTISING (air time over) -> GAP (gap over) -> IDLE; only the advertising step moves it
             enum class AdvertiseState
             {
                 IDLE,
@@ -90,27 +299,107 @@ namespace esphome
                 PAIRING     // Send 0x6e packets - sending mesh key
             };
 
-            AdvertiseState adv_state_{AdvertiseState::IDLE};
-            uint32_t state_start_time_{0};
+            // Written by the advertising step, read from the main loop
+            std::atomic<AdvertiseState> adv_state_{AdvertiseState::IDLE};
+            std::atomic<uint32_t> state_start_time_{0};
+            // Air time chosen for the packet currently being advertised, and the gap to leave after it
+            std::atomic<uint16_t> current_duration_{50};
+            std::atomic<uint16_t> current_gap_{10};
+
+            // Commands, pairing broadcasts or an advertisement on air; the scanner stays paused meanwhile
+            bool has_traffic() const;
+            ScanScheduler scan_;
+            ShardMap shard_;
+
+            // Receive path: the GAP event handler decodes mesh packets on the main loop and hands them to the
+            // consumer through the inbox
+            void on_mesh_packet(const uint8_t *adv, size_t len);
+            void handle_received(const Command &cmd);
+            // Tracks a transmitted light state until a relay by the bulbs acknowledges its sequence number;
+            // also accumulates the relay time of the packet being encoded
+            void record_sent(uint8_t sequence, const Command &cmd);
+            // Pops an unacknowledged light state that is due for another attempt
+            bool next_retransmission(uint32_t now, Command &cmd);
+            // Acks only mean something while relays are being heard (a scanner is running)
+            bool ack_feedback(uint32_t now) const { return ack_heard_ && now - last_ack_ < ACK_FEEDBACK_WINDOW_MS; }
+            // ... and only while the scanner is not paused for our own traffic, or the relays go unheard
+            bool acks_expected(uint32_t now) const { return ack_feedback(now) && !scan_.scan_paused(); }
+            InFlightTable inflight_;
+            // Relay estimates and the air-time budget (consumer side)
+            MeshTiming timing_;
+            // Longest relay time of the commands in the packet being encoded
+            uint16_t packet_relay_time_{0};
+            uint16_t ack_timeout_{250};
+            uint32_t last_ack_{0};
+            bool ack_heard_{false};
+            static const uint32_t ACK_FEEDBACK_WINDOW_MS = 30000;
+
+            // Advertising step, run from loop() or the advertising task
+            void run_advertiser(uint32_t now);
+            void try_drain_inbox();
+            bool begin_advertisement();
+            // Time until the end of the air time or gap in progress; negative once it is over
+            int32_t adv_time_left(uint32_t now) const;
+            void arm_adv_timer(uint32_t ms);
+            void on_adv_timer();
+            static void adv_timer_callback(void *arg) { static_cast<FastconController *>(arg)->on_adv_timer(); }
+            esp_timer_handle_t adv_timer_{nullptr};
+            esp_ble_adv_params_t adv_params_{};
+
+            static void advertising_task(void *arg);
+            TickType_t advertising_task_wait() const;
+            TaskHandle_t adv_task_{nullptr};
+            // Without the advertising task, keeps loop() running back to back while traffic is pending
+            HighFrequencyLoopRequester high_freq_;
+            // Above the ESPHome loop task, below the Bluetooth controller and host tasks
+            static const UBaseType_t ADV_TASK_PRIORITY = 10;
+            static const uint32_t ADV_TASK_STACK_SIZE = 4096;
+            // Wake-up period while idle
+            static const uint32_t ADV_TASK_IDLE_WAIT_MS = 50;
             
-            // Pairing mode state
-            bool pairing_mode_{false};
+            // Pairing mode state; phases and timeouts advance in loop(), the advertiser interleaves
+            // pairing advertisements with queued commands
+            void update_pairing(uint32_t now);
+            void end_pairing(const char *reason);
+            // Decides whether the next advertisement belongs to pairing; consumer_mutex_ must be held
+            bool take_pairing_slot();
+            size_t build_pairing_adv_data(uint8_t *raw);
+            // Copy the frame template from the AD flags on and patch counter, light ID, mesh key and CRC;
+            // `frame` must hold PAIRING_FRAME_SIZE bytes
+            void write_discovery_frame(uint8_t *frame);
+            void write_pairing_frame(uint8_t *frame);
+            std::atomic<bool> pairing_mode_{false};
             uint32_t pairing_start_time_{0};
-            uint32_t pairing_light_id_{1};
+            std::atomic<uint32_t> pairing_light_id_{1};
             uint32_t pairing_base_light_id_{1};  // Original starting light ID for calculating increments
             uint32_t pairing_phase_start_{0};  // When we entered the current phase
-            PairingPhase pairing_phase_{PairingPhase::DISCOVERY};
+            std::atomic<PairingPhase> pairing_phase_{PairingPhase::DISCOVERY};
+            std::atomic<bool> pairing_target_seen_{false};
+            uint8_t pairing_duty_cycle_{50};
+            uint32_t pairing_slots_{0};  // Advertisements sent while other commands were waiting (consumer side)
+            uint32_t pairing_adverts_{0};  // ... of which went to pairing
+            // Air time of one pairing advertisement (matches the original 100ms re-advertising)
+            static const uint16_t PAIRING_ADV_DURATION_MS = 100;
             uint8_t sequence_counter_{0x50};  // Pairing sequence counter
+            uint8_t discovery_counter_{0};  // Varies the discovery payload between packets
 
             // Protocol implementation
+            bool generate_command(uint8_t n, uint32_t light_id_, const uint8_t *data, size_t len, PacketBuffer &out, bool forward = true);
             std::vector<uint8_t> generate_command(uint8_t n, uint32_t light_id_, const std::vector<uint8_t> &data, bool forward = true);
 
             std::array<uint8_t, 4> mesh_key_{};
+            uint8_t sequence_{0};  // Mesh sequence number; only the consumer encodes
 
             uint16_t adv_interval_min_{0x20};
             uint16_t adv_interval_max_{0x40};
             uint16_t adv_duration_{50};
             uint16_t adv_gap_{10};
+            uint8_t advertising_sets_{1};
+            bool advertising_task_{false};
+            uint8_t burst_queue_depth_{0};
+            uint16_t burst_duration_{20};
+            uint16_t idle_duration_{100};
+            bool resend_final_state_{true};
 
             static const uint16_t MANUFACTURER_DATA_ID = 0xfff0;
         };
@@ -123,13 +412,11 @@ namespace esphome
             PairDeviceAction(FastconController *controller) : controller_(controller) {}
 
             TEMPLATABLE_VALUE(uint32_t, light_id)
-            TEMPLATABLE_VALUE(uint32_t, group_id)
 
             void play(Ts... x) override
             {
                 uint32_t light_id = this->light_id_.value(x...);
-                uint32_t group_id = this->group_id_.value(x...);
-                this->controller_->pair_device(light_id, group_id);
+                this->controller_->pair_device(light_id);
             }
 
         protected:
@@ -154,5 +441,65 @@ namespace esphome
             FastconController *controller_;
         };
 
+        // Sets several lights at once and sends them as one scene; unset values (NAN) are left as they are
+        template<typename... Ts>
+        class ApplySceneAction : public Action<Ts...>
+        {
+        public:
+            ApplySceneAction(FastconController *controller) : controller_(controller) {}
+
+            void add_light(light::LightState *state, bool on, float brightness, float red, float green, float blue,
+                           float color_temperature, float cold_white, float warm_white)
+            {
+                this->lights_.push_back({state, on, brightness, red, green, blue, color_temperature, cold_white, warm_white});
+                this->states_.push_back(state);
+            }
+
+            void play(Ts... x) override
+            {
+                // No transitions: the scene goes out as one burst, not as fading steps
+                for (const SceneEntry &entry : this->lights_)
+                {
+                    auto call = entry.state->make_call();
+                    call.set_state(entry.on);
+                    call.set_transition_length(0);
+                    if (!std::isnan(entry.brightness))
+                        call.set_brightness(entry.brightness);
+                    if (!std::isnan(entry.red))
+                        call.set_red(entry.red);
+                    if (!std::isnan(entry.green))
+                        call.set_green(entry.green);
+                    if (!std::isnan(entry.blue))
+                        call.set_blue(entry.blue);
+                    if (!std::isnan(entry.color_temperature))
+                        call.set_color_temperature(entry.color_temperature);
+                    if (!std::isnan(entry.cold_white))
+                        call.set_cold_white(entry.cold_white);
+                    if (!std::isnan(entry.warm_white))
+                        call.set_warm_white(entry.warm_white);
+                    call.perform();
+                }
+                this->controller_->apply_scene(this->states_);
+            }
+
+        protected:
+            struct SceneEntry
+            {
+                light::LightState *state;
+                bool on;
+                float brightness;
+                float red;
+                float green;
+                float blue;
+                float color_temperature;
+                float cold_white;
+                float warm_white;
+            };
+
+            FastconController *controller_;
+            std::vector<SceneEntry> lights_;
+            std::vector<light::LightState *> states_;
+        };
+
     } // namespace fastcon
 } // namespace esphome
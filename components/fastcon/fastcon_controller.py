@@ -1,23 +1,100 @@
+import logging
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.const import CONF_ID
-from esphome.core import HexInt
+import esphome.final_validate as fv
+from esphome.components import esp32_ble, light, sensor
+from esphome.components.esp32 import (
+    VARIANT_ESP32,
+    add_idf_sdkconfig_option,
+    get_esp32_variant,
+)
+from esphome.const import (
+    CONF_ID,
+    CONF_UPDATE_INTERVAL,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
+    __version__ as ESPHOME_VERSION,
+)
+from esphome.core import CORE, HexInt
 from esphome import automation
 
+_LOGGER = logging.getLogger(__name__)
+
 DEPENDENCIES = ["esp32_ble"]
 
+# Later esp32_ble releases deliver scan results only to a GAPScanEventHandler; the receive path
+# (acknowledgements, state sync, heartbeats, learned relay times) never sees a packet there
+ESPHOME_VERSION_LIMIT = cv.Version(2025, 6, 0)
+
+
+def AUTO_LOAD():
+    # The diagnostic sensors are the only part that needs the sensor component
+    conf = CORE.raw_config.get("fastcon") if CORE.raw_config else None
+    if isinstance(conf, dict) and CONF_METRICS in conf:
+        return ["sensor"]
+    return []
+
+
 CONF_MESH_KEY = "mesh_key"
 CONF_ADV_INTERVAL_MIN = "adv_interval_min"
 CONF_ADV_INTERVAL_MAX = "adv_interval_max"
 CONF_ADV_DURATION = "adv_duration"
 CONF_ADV_GAP = "adv_gap"
 CONF_MAX_QUEUE_SIZE = "max_queue_size"
+CONF_COMPACT_ENCODER = "compact_encoder"
+CONF_MAX_BATCH_SIZE = "max_batch_size"
+CONF_ADVERTISING_SETS = "advertising_sets"
+CONF_ADVERTISING_TASK = "advertising_task"
+CONF_ADAPTIVE_TIMING = "adaptive_timing"
+CONF_BURST_QUEUE_DEPTH = "burst_queue_depth"
+CONF_BURST_DURATION = "burst_duration"
+CONF_IDLE_DURATION = "idle_duration"
+CONF_RESEND_FINAL_STATE = "resend_final_state"
+CONF_PAIRING_DUTY_CYCLE = "pairing_duty_cycle"
+CONF_ACK_TIMEOUT = "ack_timeout"
+CONF_RESTORE_STATE = "restore_state"
+CONF_STATE_SAVE_INTERVAL = "state_save_interval"
+CONF_RELAY_TIMING = "relay_timing"
+CONF_HOP_TIME = "hop_time"
+CONF_LEARN = "learn"
+CONF_AIR_TIME_BUDGET = "air_time_budget"
+CONF_SCAN_COEXISTENCE = "scan_coexistence"
+CONF_RESUME_DELAY = "resume_delay"
+CONF_MAX_PAUSE = "max_pause"
+CONF_SCAN_WINDOW = "scan_window"
+CONF_SCAN_DURATION = "scan_duration"
+CONF_SHARD = "shard"
+CONF_INDEX = "index"
+CONF_COUNT = "count"
+CONF_STRATEGY = "strategy"
+CONF_FAILOVER = "failover"
+CONF_HEARTBEAT_INTERVAL = "heartbeat_interval"
+CONF_FAILOVER_TIMEOUT = "failover_timeout"
+CONF_METRICS = "metrics"
+CONF_COMMAND_LATENCY = "command_latency"
+CONF_COMMAND_LATENCY_P95 = "command_latency_p95"
+CONF_COMMAND_LATENCY_MAX = "command_latency_max"
+CONF_QUEUE_HIGH_WATER = "queue_high_water"
+CONF_DROPPED_COMMANDS = "dropped_commands"
+CONF_COALESCED_COMMANDS = "coalesced_commands"
+CONF_DUPLICATE_STATES = "duplicate_states"
+CONF_PACKETS_PER_SECOND = "packets_per_second"
+CONF_DUTY_CYCLE = "duty_cycle"
 
 DEFAULT_ADV_INTERVAL_MIN = 0x20
 DEFAULT_ADV_INTERVAL_MAX = 0x40
 DEFAULT_ADV_DURATION = 50
 DEFAULT_ADV_GAP = 10
 DEFAULT_MAX_QUEUE_SIZE = 100
+DEFAULT_MAX_BATCH_SIZE = 1
+DEFAULT_ADVERTISING_SETS = 1
+DEFAULT_BURST_QUEUE_DEPTH = 4
+DEFAULT_BURST_DURATION = 20
+DEFAULT_IDLE_DURATION = 100
 
 
 def validate_hex_bytes(value):
@@ -33,14 +110,172 @@ def validate_hex_bytes(value):
     raise cv.Invalid("Mesh key must be a string")
 
 
+ADAPTIVE_TIMING_SCHEMA = cv.Schema(
+    {
+        cv.Optional(
+            CONF_BURST_QUEUE_DEPTH, default=DEFAULT_BURST_QUEUE_DEPTH
+        ): cv.int_range(min=1, max=255),
+        cv.Optional(CONF_BURST_DURATION, default=DEFAULT_BURST_DURATION): cv.uint16_t,
+        cv.Optional(CONF_IDLE_DURATION, default=DEFAULT_IDLE_DURATION): cv.uint16_t,
+        cv.Optional(CONF_RESEND_FINAL_STATE, default=True): cv.boolean,
+    }
+)
+
+RELAY_TIMING_SCHEMA = cv.Schema(
+    {
+        # Relay time per hop for lights with relay_hops
+        cv.Optional(CONF_HOP_TIME, default="30ms"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(max=cv.TimePeriod(milliseconds=250)),
+        ),
+        # Measure the relay time of each light from the acknowledgements (needs a scanner)
+        cv.Optional(CONF_LEARN, default=True): cv.boolean,
+    }
+)
+
+SCAN_COEXISTENCE_SCHEMA = cv.Schema(
+    {
+        # Quiet time after the last command before scanning resumes
+        cv.Optional(
+            CONF_RESUME_DELAY, default="500ms"
+        ): cv.positive_time_period_milliseconds,
+        # Longest scan pause during a burst before a scan window is inserted (0 = never)
+        cv.Optional(
+            CONF_MAX_PAUSE, default="2s"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(
+            CONF_SCAN_WINDOW, default="200ms"
+        ): cv.positive_time_period_milliseconds,
+        # Duration passed to the scanner when it is resumed
+        cv.Optional(CONF_SCAN_DURATION, default="300s"): cv.All(
+            cv.positive_time_period_seconds, cv.Range(min=cv.TimePeriod(seconds=1))
+        ),
+    }
+)
+
+
+def _latency_sensor_schema():
+    return sensor.sensor_schema(
+        unit_of_measurement=UNIT_MILLISECOND,
+        icon="mdi:timer-sand",
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    )
+
+
+def _counter_sensor_schema(icon):
+    return sensor.sensor_schema(
+        icon=icon,
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_TOTAL_INCREASING,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    )
+
+
+METRICS_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=cv.TimePeriod(seconds=1)),
+        ),
+        # Queue-to-air time of the commands sent during the interval
+        cv.Optional(CONF_COMMAND_LATENCY): _latency_sensor_schema(),
+        cv.Optional(CONF_COMMAND_LATENCY_P95): _latency_sensor_schema(),
+        cv.Optional(CONF_COMMAND_LATENCY_MAX): _latency_sensor_schema(),
+        # Most commands waiting at once during the interval
+        cv.Optional(CONF_QUEUE_HIGH_WATER): sensor.sensor_schema(
+            icon="mdi:tray-full",
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        # Totals since boot
+        cv.Optional(CONF_DROPPED_COMMANDS): _counter_sensor_schema("mdi:tray-remove"),
+        cv.Optional(CONF_COALESCED_COMMANDS): _counter_sensor_schema("mdi:set-merge"),
+        cv.Optional(CONF_DUPLICATE_STATES): _counter_sensor_schema("mdi:content-duplicate"),
+        cv.Optional(CONF_PACKETS_PER_SECOND): sensor.sensor_schema(
+            unit_of_measurement="packets/s",
+            icon="mdi:broadcast",
+            accuracy_decimals=1,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        # Share of the interval spent advertising
+        cv.Optional(CONF_DUTY_CYCLE): sensor.sensor_schema(
+            unit_of_measurement=UNIT_PERCENT,
+            icon="mdi:radio-tower",
+            accuracy_decimals=1,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    }
+)
+
+METRIC_SENSORS = [
+    CONF_COMMAND_LATENCY,
+    CONF_COMMAND_LATENCY_P95,
+    CONF_COMMAND_LATENCY_MAX,
+    CONF_QUEUE_HIGH_WATER,
+    CONF_DROPPED_COMMANDS,
+    CONF_COALESCED_COMMANDS,
+    CONF_DUPLICATE_STATES,
+    CONF_PACKETS_PER_SECOND,
+    CONF_DUTY_CYCLE,
+]
+
 fastcon_ns = cg.esphome_ns.namespace("fastcon")
-FastconController = fastcon_ns.class_("FastconController", cg.Component)
+FastconController = fastcon_ns.class_(
+    "FastconController", cg.Component, esp32_ble.GAPEventHandler
+)
+ShardMap = fastcon_ns.class_("ShardMap")
+ShardStrategy = ShardMap.enum("Strategy", is_class=True)
+SHARD_STRATEGIES = {
+    "range": ShardStrategy.RANGE,
+    "hash": ShardStrategy.HASH,
+}
+
+
+def validate_shard(config):
+    if config[CONF_INDEX] >= config[CONF_COUNT]:
+        raise cv.Invalid(
+            f"{CONF_INDEX} ({config[CONF_INDEX]}) must be lower than {CONF_COUNT} ({config[CONF_COUNT]})"
+        )
+    if config[CONF_FAILOVER_TIMEOUT] <= config[CONF_HEARTBEAT_INTERVAL]:
+        raise cv.Invalid(
+            f"{CONF_FAILOVER_TIMEOUT} must be longer than {CONF_HEARTBEAT_INTERVAL}"
+        )
+    return config
+
+
+SHARD_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            # Position of this controller among the controllers sharing the mesh key
+            cv.Required(CONF_INDEX): cv.int_range(min=0, max=7),
+            cv.Required(CONF_COUNT): cv.int_range(min=1, max=8),
+            cv.Optional(CONF_STRATEGY, default="hash"): cv.enum(
+                SHARD_STRATEGIES, lower=True
+            ),
+            # Broadcast heartbeats and take over the lights of a silent peer
+            cv.Optional(CONF_FAILOVER, default=True): cv.boolean,
+            cv.Optional(
+                CONF_HEARTBEAT_INTERVAL, default="5s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_FAILOVER_TIMEOUT, default="20s"
+            ): cv.positive_time_period_milliseconds,
+        }
+    ),
+    validate_shard,
+)
 
 CONFIG_SCHEMA = cv.Schema(
     {
         cv.Optional(CONF_ID, default="fastcon_controller"): cv.declare_id(
             FastconController
         ),
+        cv.GenerateID(esp32_ble.CONF_BLE_ID): cv.use_id(esp32_ble.ESP32BLE),
         cv.Required(CONF_MESH_KEY): validate_hex_bytes,
         cv.Optional(
             CONF_ADV_INTERVAL_MIN, default=DEFAULT_ADV_INTERVAL_MIN
@@ -50,17 +285,105 @@ CONFIG_SCHEMA = cv.Schema(
         ): cv.uint16_t,
         cv.Optional(CONF_ADV_DURATION, default=DEFAULT_ADV_DURATION): cv.uint16_t,
         cv.Optional(CONF_ADV_GAP, default=DEFAULT_ADV_GAP): cv.uint16_t,
+        # The command inbox is allocated statically, so keep it bounded
         cv.Optional(
             CONF_MAX_QUEUE_SIZE, default=DEFAULT_MAX_QUEUE_SIZE
-        ): cv.positive_int,
+        ): cv.int_range(min=1, max=1024),
+        cv.Optional(CONF_COMPACT_ENCODER, default=False): cv.boolean,
+        # The 12-byte control payload fits at most four of the smallest (3-byte) records
+        cv.Optional(
+            CONF_MAX_BATCH_SIZE, default=DEFAULT_MAX_BATCH_SIZE
+        ): cv.int_range(min=1, max=4),
+        # More than one set uses BLE 5 extended advertising (ESP32-C3/S3 and newer)
+        cv.Optional(
+            CONF_ADVERTISING_SETS, default=DEFAULT_ADVERTISING_SETS
+        ): cv.int_range(min=1, max=4),
+        # Advertise from a dedicated FreeRTOS task on the Bluetooth host core
+        cv.Optional(CONF_ADVERTISING_TASK, default=False): cv.boolean,
+        # Shorter air time while the queue is deep, longer when idle
+        cv.Optional(CONF_ADAPTIVE_TIMING): ADAPTIVE_TIMING_SCHEMA,
+        # Share of advertisements pairing takes while other commands are queued
+        cv.Optional(CONF_PAIRING_DUTY_CYCLE, default="50%"): cv.All(
+            cv.percentage, cv.Range(min=0.1)
+        ),
+        # Retransmit a light state not relayed by the bulbs within this time (doubling per attempt)
+        cv.Optional(CONF_ACK_TIMEOUT, default="250ms"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=cv.TimePeriod(milliseconds=20), max=cv.TimePeriod(seconds=10)),
+        ),
+        # Keep the sequence number and the last state of each light in flash across restarts
+        cv.Optional(CONF_RESTORE_STATE, default=True): cv.boolean,
+        cv.Optional(CONF_STATE_SAVE_INTERVAL, default="10s"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=cv.TimePeriod(seconds=1)),
+        ),
+        # Leave the mesh time to relay each packet before sending the next
+        cv.Optional(CONF_RELAY_TIMING): RELAY_TIMING_SCHEMA,
+        # Share of every second the controller may advertise
+        cv.Optional(CONF_AIR_TIME_BUDGET, default="100%"): cv.All(
+            cv.percentage, cv.Range(min=0.01)
+        ),
+        # Pause the BLE scanner only while commands are queued
+        cv.Optional(CONF_SCAN_COEXISTENCE): SCAN_COEXISTENCE_SCHEMA,
+        # Split the lights of one mesh between several controllers
+        cv.Optional(CONF_SHARD): SHARD_SCHEMA,
+        # Diagnostic sensors: command latency, queue depth and air time
+        cv.Optional(CONF_METRICS): METRICS_SCHEMA,
     }
 ).extend(cv.COMPONENT_SCHEMA)
 
 
+def _validate_esphome_version(config):
+    # Transmitting is unaffected; without received packets the controller simply runs without
+    # acknowledgements (blind repeats), state sync, shard failover and learned relay times
+    if cv.Version.parse(ESPHOME_VERSION) >= ESPHOME_VERSION_LIMIT:
+        _LOGGER.warning(
+            "ESPHome %s no longer passes scan results to the fastcon controller: acknowledgements, "
+            "state sync, shard failover and learned relay times stay off. Use a release before %s "
+            "for the receive path",
+            ESPHOME_VERSION,
+            ESPHOME_VERSION_LIMIT,
+        )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(CONFIG_SCHEMA, _validate_esphome_version)
+
+
+def _final_validate(config):
+    # Extended advertising switches the Bluetooth controller to the BLE 5 command set, which then
+    # rejects the legacy scan commands used by esp32_ble_tracker and the scan coexistence pause
+    if config[CONF_ADVERTISING_SETS] <= 1 or get_esp32_variant() == VARIANT_ESP32:
+        return config
+    full_config = fv.full_config.get()
+    if "esp32_ble_tracker" in full_config:
+        raise cv.Invalid(
+            f"{CONF_ADVERTISING_SETS} above 1 cannot be combined with esp32_ble_tracker: "
+            "the Bluetooth controller rejects its legacy scan commands once extended "
+            "advertising is used",
+            path=[CONF_ADVERTISING_SETS],
+        )
+    if CONF_SCAN_COEXISTENCE in config:
+        raise cv.Invalid(
+            f"{CONF_ADVERTISING_SETS} above 1 cannot be combined with "
+            f"{CONF_SCAN_COEXISTENCE}: the Bluetooth controller rejects the legacy scan "
+            "commands once extended advertising is used",
+            path=[CONF_ADVERTISING_SETS],
+        )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
 
+    # GAP events: scanner state, received mesh packets and advertising failure reports
+    ble = await cg.get_variable(config[esp32_ble.CONF_BLE_ID])
+    cg.add(ble.register_gap_event_handler(var))
+
     if CONF_MESH_KEY in config:
         mesh_key = config[CONF_MESH_KEY]
         key_bytes = [(mesh_key >> (i * 8)) & 0xFF for i in range(3, -1, -1)]
@@ -76,12 +399,92 @@ async def to_code(config):
     cg.add(var.set_adv_interval_max(config[CONF_ADV_INTERVAL_MAX]))
     cg.add(var.set_adv_duration(config[CONF_ADV_DURATION]))
     cg.add(var.set_adv_gap(config[CONF_ADV_GAP]))
-    cg.add(var.set_max_queue_size(config[CONF_MAX_QUEUE_SIZE]))
+    # Sizes the fixed-capacity command inbox at compile time
+    cg.add_define("FASTCON_MAX_QUEUE_SIZE", config[CONF_MAX_QUEUE_SIZE])
+    cg.add(var.set_max_batch_size(config[CONF_MAX_BATCH_SIZE]))
+    cg.add(var.set_ack_timeout(config[CONF_ACK_TIMEOUT]))
+    cg.add(var.set_restore_state(config[CONF_RESTORE_STATE]))
+    cg.add(var.set_state_save_interval(config[CONF_STATE_SAVE_INTERVAL]))
+    cg.add(var.set_air_time_budget(round(config[CONF_AIR_TIME_BUDGET] * 100)))
+    if CONF_RELAY_TIMING in config:
+        relay = config[CONF_RELAY_TIMING]
+        cg.add(var.set_relay_timing(relay[CONF_HOP_TIME], relay[CONF_LEARN]))
+    cg.add(
+        var.set_pairing_duty_cycle(round(config[CONF_PAIRING_DUTY_CYCLE] * 100))
+    )
+
+    if config[CONF_ADVERTISING_TASK]:
+        cg.add(var.set_advertising_task(True))
+
+    if CONF_ADAPTIVE_TIMING in config:
+        adaptive = config[CONF_ADAPTIVE_TIMING]
+        cg.add(
+            var.set_adaptive_timing(
+                adaptive[CONF_BURST_QUEUE_DEPTH],
+                adaptive[CONF_BURST_DURATION],
+                adaptive[CONF_IDLE_DURATION],
+                adaptive[CONF_RESEND_FINAL_STATE],
+            )
+        )
+
+    # Pause the scan through esp32_ble_tracker when it owns the scanner, so the two do not fight
+    if "esp32_ble_tracker" in CORE.loaded_integrations:
+        cg.add_define("USE_FASTCON_BLE_TRACKER")
+
+    if CONF_SCAN_COEXISTENCE in config:
+        scan = config[CONF_SCAN_COEXISTENCE]
+        cg.add(
+            var.set_scan_coexistence(
+                scan[CONF_RESUME_DELAY],
+                scan[CONF_MAX_PAUSE],
+                scan[CONF_SCAN_WINDOW],
+                scan[CONF_SCAN_DURATION],
+            )
+        )
+
+    if CONF_SHARD in config:
+        shard = config[CONF_SHARD]
+        cg.add(
+            var.set_shard(shard[CONF_INDEX], shard[CONF_COUNT], shard[CONF_STRATEGY])
+        )
+        if shard[CONF_FAILOVER]:
+            cg.add(
+                var.set_shard_failover(
+                    shard[CONF_HEARTBEAT_INTERVAL], shard[CONF_FAILOVER_TIMEOUT]
+                )
+            )
+
+    if CONF_METRICS in config:
+        metrics = config[CONF_METRICS]
+        cg.add(var.set_metrics_interval(metrics[CONF_UPDATE_INTERVAL]))
+        for key in METRIC_SENSORS:
+            if key in metrics:
+                sens = await sensor.new_sensor(metrics[key])
+                cg.add(getattr(var, f"set_{key}_sensor")(sens))
+
+    if config[CONF_ADVERTISING_SETS] > 1:
+        if get_esp32_variant() == VARIANT_ESP32:
+            _LOGGER.warning(
+                "%s: the classic ESP32 has no BLE 5 extended advertising, using legacy advertising",
+                CONF_ADVERTISING_SETS,
+            )
+        else:
+            cg.add_define("USE_FASTCON_EXTENDED_ADVERTISING")
+            if CORE.using_esp_idf:
+                # Keep the legacy API available for other BLE components
+                add_idf_sdkconfig_option("CONFIG_BT_BLE_50_FEATURES_SUPPORTED", True)
+                add_idf_sdkconfig_option("CONFIG_BT_BLE_42_FEATURES_SUPPORTED", True)
+            cg.add(var.set_advertising_sets(config[CONF_ADVERTISING_SETS]))
+
+    if config[CONF_COMPACT_ENCODER]:
+        # Trade the CRC/bit-reverse lookup tables for bitwise loops
+        cg.add_define("FASTCON_COMPACT_ENCODER")
 
 
 # Actions for pairing
 PairDeviceAction = fastcon_ns.class_("PairDeviceAction", automation.Action)
 FactoryResetAction = fastcon_ns.class_("FactoryResetAction", automation.Action)
+ApplySceneAction = fastcon_ns.class_("ApplySceneAction", automation.Action)
 
 
 @automation.register_action(
@@ -90,7 +493,8 @@ FactoryResetAction = fastcon_ns.class_("FactoryResetAction", automation.Action)
     cv.Schema({
         cv.GenerateID(): cv.use_id(FastconController),
         cv.Required("light_id"): cv.templatable(cv.positive_int),
-        cv.Optional("group_id", default=1): cv.templatable(cv.positive_int),
+        # Accepted for older configs; the pairing broadcast carries no group
+        cv.Optional("group_id"): cv.templatable(cv.positive_int),
     })
 )
 async def fastcon_pair_device_to_code(config, action_id, template_arg, args):
@@ -99,9 +503,12 @@ async def fastcon_pair_device_to_code(config, action_id, template_arg, args):
     
     template_ = await cg.templatable(config["light_id"], args, cg.uint32)
     cg.add(action.set_light_id(template_))
-    
-    template_ = await cg.templatable(config["group_id"], args, cg.uint32)
-    cg.add(action.set_group_id(template_))
+
+    if "group_id" in config:
+        _LOGGER.warning(
+            "fastcon.pair_device: group_id has no effect, pairing does not assign a group. "
+            "Set group_id on the light instead"
+        )
     
     return action
 
@@ -122,3 +529,57 @@ async def fastcon_factory_reset_to_code(config, action_id, template_arg, args):
     cg.add(action.set_light_id(template_))
     
     return action
+
+
+CONF_LIGHTS = "lights"
+CONF_BRIGHTNESS = "brightness"
+CONF_RED = "red"
+CONF_GREEN = "green"
+CONF_BLUE = "blue"
+CONF_COLOR_TEMPERATURE = "color_temperature"
+CONF_COLD_WHITE = "cold_white"
+CONF_WARM_WHITE = "warm_white"
+
+SCENE_LIGHT_SCHEMA = cv.Schema({
+    cv.Required(CONF_ID): cv.use_id(light.LightState),
+    cv.Optional("state", default=True): cv.boolean,
+    cv.Optional(CONF_BRIGHTNESS): cv.percentage,
+    cv.Optional(CONF_RED): cv.percentage,
+    cv.Optional(CONF_GREEN): cv.percentage,
+    cv.Optional(CONF_BLUE): cv.percentage,
+    cv.Optional(CONF_COLOR_TEMPERATURE): cv.color_temperature,
+    cv.Optional(CONF_COLD_WHITE): cv.percentage,
+    cv.Optional(CONF_WARM_WHITE): cv.percentage,
+})
+
+
+@automation.register_action(
+    "fastcon.apply_scene",
+    ApplySceneAction,
+    cv.Schema({
+        cv.GenerateID(): cv.use_id(FastconController),
+        cv.Required(CONF_LIGHTS): cv.All(cv.ensure_list(SCENE_LIGHT_SCHEMA), cv.Length(min=1)),
+    })
+)
+async def fastcon_apply_scene_to_code(config, action_id, template_arg, args):
+    var = await cg.get_variable(config[CONF_ID])
+    action = cg.new_Pvariable(action_id, template_arg, var)
+
+    for conf in config[CONF_LIGHTS]:
+        state = await cg.get_variable(conf[CONF_ID])
+        # Values that are not set are left as the light has them
+        values = [
+            conf.get(key, cg.RawExpression("NAN"))
+            for key in (
+                CONF_BRIGHTNESS,
+                CONF_RED,
+                CONF_GREEN,
+                CONF_BLUE,
+                CONF_COLOR_TEMPERATURE,
+                CONF_COLD_WHITE,
+                CONF_WARM_WHITE,
+            )
+        ]
+        cg.add(action.add_light(state, conf["state"], *values))
+
+    return action
@@ -18,7 +18,34 @@ namespace esphome
                 this->mark_failed();
                 return;
             }
-            ESP_LOGCONFIG(TAG, "Setting up Fastcon BLE light (ID: %d) with command deduplication...", this->light_id_);
+            if (this->is_group_light())
+            {
+                if (this->group_id_ == 0)
+                {
+                    ESP_LOGE(TAG, "Group light needs a group ID!");
+                    this->mark_failed();
+                    return;
+                }
+                ESP_LOGCONFIG(TAG, "Setting up Fastcon BLE group light (group: %d) with command deduplication...", this->group_id_);
+            }
+            else
+            {
+                ESP_LOGCONFIG(TAG, "Setting up Fastcon BLE light (ID: %d) with command deduplication...", this->light_id_);
+                if (this->group_id_ != 0)
+                {
+                    this->controller_->add_group_member(this->group_id_, this->light_id_);
+                }
+                if (this->relay_hops_ != MeshTiming::UNKNOWN_HOPS)
+                {
+                    this->controller_->set_relay_hops(this->light_id_, this->relay_hops_);
+                }
+            }
+
+            if (this->slot() == LightDebouncer::INVALID_INDEX)
+            {
+                ESP_LOGE(TAG, "Too many lights on the controller");
+                this->mark_failed();
+            }
         }
 
         void FastconLight::set_controller(FastconController *controller)
@@ -29,86 +56,90 @@ namespace esphome
         light::LightTraits FastconLight::get_traits()
         {
             auto traits = light::LightTraits();
-            traits.set_supported_color_modes({light::ColorMode::RGB, light::ColorMode::WHITE, light::ColorMode::BRIGHTNESS, light::ColorMode::COLD_WARM_WHITE});
-            traits.set_min_mireds(153);
-            traits.set_max_mireds(500);
+            switch (this->light_type_)
+            {
+            case LightType::BRIGHTNESS:
+                traits.set_supported_color_modes({light::ColorMode::BRIGHTNESS});
+                break;
+            case LightType::CWWW:
+                traits.set_supported_color_modes({light::ColorMode::COLOR_TEMPERATURE});
+                break;
+            case LightType::RGBCW:
+                traits.set_supported_color_modes({light::ColorMode::RGB, light::ColorMode::WHITE, light::ColorMode::BRIGHTNESS, light::ColorMode::COLD_WARM_WHITE});
+                break;
+            }
+            traits.set_min_mireds(MIN_MIREDS);
+            traits.set_max_mireds(MAX_MIREDS);
             return traits;
         }
 
-        void FastconLight::loop()
+        uint16_t FastconLight::slot()
         {
-            // **OPTIMIZATION: Debounced command sending**
-            if (!has_pending_command_)
-                return;
-
-            uint32_t now = millis();
-            
-            // Check if debounce period has elapsed
-            uint32_t time_since_change = now - last_state_change_;
-            if (time_since_change < DEBOUNCE_MS)
-                return;
-            
-            // Check if minimum interval between commands has elapsed
-            uint32_t time_since_sent = now - last_command_sent_;
-            if (time_since_sent < MIN_INTERVAL_MS)
-                return;
+            // ESPHome may restore the light state before setup() has run
+            if (this->slot_ == LightDebouncer::INVALID_INDEX && this->controller_ != nullptr)
+                this->slot_ = this->controller_->add_light(this->target(), this->debounce_ms_, this->min_interval_ms_, this,
+                                                           this->encoder_);
+            return this->slot_;
+        }
 
-            // **OPTIMIZATION: Command deduplication**
-            // Skip if command is identical to last sent command
-            if (pending_data_ == last_sent_data_)
+        bool FastconLight::send_transition_target(light::LightState *state)
+        {
+            if (!this->transition_target_ || !state->is_transformer_active())
             {
-                ESP_LOGV(TAG, "Skipping duplicate command for light %d", light_id_);
-                has_pending_command_ = false;
-                return;
+                transition_sent_ = false;
+                return false;
             }
 
-            // Send the pending command
-            ESP_LOGD(TAG, "Sending debounced command for light %d (delayed %dms)", light_id_, time_since_change);
-            
-            // Debug output - print payload as hex
-            auto hex_str = vector_to_hex_string(pending_data_).data();
-            ESP_LOGD(TAG, "Advertisement Payload (%d bytes): %s", pending_data_.size(), hex_str);
+            // remote_values holds where the transition ends; send that once, right away
+            LightData target_state;
+            this->encoder_(state->remote_values, target_state);
+            if (transition_sent_ && target_state == transition_state_)
+                return true;
+
+            if (!this->controller_->send_light_state(this->slot(), this->target(), target_state))
+                return false;
 
-            // Send the advertisement
-            this->controller_->queueCommand(this->light_id_, pending_data_);
-            
-            // Update tracking
-            last_sent_data_ = pending_data_;
-            last_command_sent_ = now;
-            has_pending_command_ = false;
+            ESP_LOGD(TAG, "Sent transition target for light %d", light_id_);
+            transition_state_ = target_state;
+            transition_sent_ = true;
+            return true;
         }
 
         void FastconLight::write_state(light::LightState *state)
         {
-            // Get the light data bits from the state
-            auto light_data = this->controller_->get_light_data(state);
+            if (this->controller_ == nullptr)
+                return;
+
+            // Intermediate transition steps are dropped once the target has been sent
+            if (this->send_transition_target(state))
+                return;
+
+            // **OPTIMIZATION: Instead of sending immediately, hand only the logical state to the controller**
+            LightData pending_state;
+            this->encoder_(state->current_values, pending_state);
+            this->controller_->set_light_state(this->slot(), pending_state);
 
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE
             // Debug output - print the light state values
-            bool is_on = (light_data[0] & 0x80) != 0;
-            float brightness = ((light_data[0] & 0x7F) / 127.0f) * 100.0f;
-            if (light_data.size() == 1)
+            const uint8_t *light_data = pending_state.data();
+            [[maybe_unused]] bool is_on = (light_data[0] & 0x80) != 0;
+            [[maybe_unused]] float brightness = ((light_data[0] & 0x7F) / 127.0f) * 100.0f;
+            if (pending_state.size() == 1)
             {
                 ESP_LOGV(TAG, "State change: light_id=%d, on=%d, brightness=%.1f%%", light_id_, is_on, brightness);
             }
             else
             {
-                auto r = light_data[2];
-                auto g = light_data[3];
-                auto b = light_data[1];
-                auto warm = light_data[4];
-                auto cold = light_data[5];
+                [[maybe_unused]] auto r = light_data[2];
+                [[maybe_unused]] auto g = light_data[3];
+                [[maybe_unused]] auto b = light_data[1];
+                [[maybe_unused]] auto warm = light_data[4];
+                [[maybe_unused]] auto cold = light_data[5];
                 ESP_LOGV(TAG, "State change: light_id=%d, on=%d, brightness=%.1f%%, rgb=(%d,%d,%d), warm=%d, cold=%d", 
                          light_id_, is_on, brightness, r, g, b, warm, cold);
             }
+#endif
 
-            // Generate the advertisement payload
-            auto adv_data = this->controller_->single_control(this->light_id_, light_data);
-
-            // **OPTIMIZATION: Instead of sending immediately, mark as pending**
-            pending_data_ = adv_data;
-            last_state_change_ = millis();
-            has_pending_command_ = true;
-            
             ESP_LOGV(TAG, "Command pending for light %d, will send after debounce", light_id_);
         }
     } // namespace fastcon
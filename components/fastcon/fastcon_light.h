@@ -20,27 +20,52 @@ namespace esphome
         class FastconLight : public Component, public light::LightOutput
         {
         public:
+            // A light_id of 0 makes this a group light addressing every light in group_id
             FastconLight(uint8_t light_id) : light_id_(light_id) {}
 
+            // No loop(): the controller sends the debounced states of all lights in one pass
             void setup() override;
-            void loop() override;  // Add loop for debouncing
             light::LightTraits get_traits() override;
             void write_state(light::LightState *state) override;
             void set_controller(FastconController *controller);
+            void set_group_id(uint8_t group_id) { group_id_ = group_id; }
+            void set_debounce(uint16_t ms) { debounce_ms_ = ms; }
+            void set_min_interval(uint16_t ms) { min_interval_ms_ = ms; }
+            // Send the target of an ESPHome transition once instead of its intermediate steps
+            void set_transition_target(bool enabled) { transition_target_ = enabled; }
+            // Mesh hops between the controller and this light, for the controller's relay timing
+            void set_relay_hops(uint8_t hops) { relay_hops_ = hops; }
+            // Color modes offered to Home Assistant; also selects the light data encoder
+            void set_light_type(LightType type)
+            {
+                light_type_ = type;
+                encoder_ = light_encoder(type);
+            }
+
+            bool is_group_light() const { return light_id_ == 0; }
 
         protected:
+            uint32_t target() const { return is_group_light() ? group_target(group_id_) : light_target(light_id_); }
+            // Index of this light in the controller's debounce table, registered on first use
+            uint16_t slot();
+
             FastconController *controller_{nullptr};
             uint8_t light_id_;
-            
-            // **OPTIMIZATION: State tracking and debouncing**
-            std::vector<uint8_t> last_sent_data_;       // Track last command sent
-            std::vector<uint8_t> pending_data_;         // Pending command to send
-            uint32_t last_state_change_{0};             // Time of last write_state() call
-            uint32_t last_command_sent_{0};             // Time of last actual BLE command
-            bool has_pending_command_{false};           // Flag for pending command
-            
-            static const uint32_t DEBOUNCE_MS = 100;    // Wait 100ms before sending
-            static const uint32_t MIN_INTERVAL_MS = 300; // Minimum 300ms between commands (matches throttle)
+            uint8_t group_id_{0};
+            LightType light_type_{LightType::RGBCW};
+            LightEncoder encoder_{light_encoder(LightType::RGBCW)};
+
+            // **OPTIMIZATION: Debouncing** - the pending state and its timestamps live in the controller
+            uint16_t slot_{LightDebouncer::INVALID_INDEX};
+            uint16_t debounce_ms_{100};                 // Wait 100ms before sending
+            uint16_t min_interval_ms_{300};             // Minimum 300ms between commands (matches throttle)
+            uint8_t relay_hops_{MeshTiming::UNKNOWN_HOPS};
+
+            // **OPTIMIZATION: Transition-aware sending** - the bulb fades by itself
+            bool send_transition_target(light::LightState *state);
+            bool transition_target_{true};
+            bool transition_sent_{false};               // Target of the running transition already sent
+            LightData transition_state_;                // Target state that was sent
         };
     } // namespace fastcon
 } // namespace esphome
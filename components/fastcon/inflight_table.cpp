@@ -0,0 +1,74 @@
+#include "inflight_table.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        void InFlightTable::add(uint8_t sequence, const Command &cmd, uint32_t sent_at, uint32_t due)
+        {
+            // Superseded: only the newest packet per target is worth retransmitting
+            remove(cmd.target);
+
+            Entry *slot = nullptr;
+            for (auto &entry : entries_)
+            {
+                if (!entry.active)
+                {
+                    slot = &entry;
+                    break;
+                }
+                if (slot == nullptr || static_cast<int32_t>(entry.due - slot->due) < 0)
+                    slot = &entry;
+            }
+
+            slot->cmd = cmd;
+            slot->sent_at = sent_at;
+            slot->due = due;
+            slot->sequence = sequence;
+            slot->active = true;
+        }
+
+        bool InFlightTable::remove(uint32_t target)
+        {
+            bool removed = false;
+            for (auto &entry : entries_)
+            {
+                if (entry.active && entry.cmd.target == target)
+                {
+                    entry.active = false;
+                    removed = true;
+                }
+            }
+            return removed;
+        }
+
+        bool InFlightTable::pop_due(uint32_t now, Command &out)
+        {
+            Entry *due = nullptr;
+            for (auto &entry : entries_)
+            {
+                if (!entry.active || static_cast<int32_t>(now - entry.due) < 0)
+                    continue;
+                if (due == nullptr || static_cast<int32_t>(entry.due - due->due) < 0)
+                    due = &entry;
+            }
+            if (due == nullptr)
+                return false;
+
+            due->active = false;
+            out = due->cmd;
+            return true;
+        }
+
+        size_t InFlightTable::size() const
+        {
+            size_t count = 0;
+            for (const auto &entry : entries_)
+            {
+                if (entry.active)
+                    count++;
+            }
+            return count;
+        }
+    } // namespace fastcon
+} // namespace esphome
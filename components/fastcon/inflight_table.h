@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "command_scheduler.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Packets on their way through the mesh, keyed by sequence number. Each entry keeps the
+        // logical command so an unacknowledged light state can be sent again; a newer packet for
+        // the same target supersedes the entry, so only the final state is ever retransmitted.
+        class InFlightTable
+        {
+        public:
+            static const size_t CAPACITY = 16;
+
+            // Records a packet sent with `sequence` at `sent_at`; the oldest entry makes room when full
+            void add(uint8_t sequence, const Command &cmd, uint32_t sent_at, uint32_t due);
+            // Forgets the packet in flight for `target`, if any
+            bool remove(uint32_t target);
+            // Pops an entry whose acknowledgement is overdue
+            bool pop_due(uint32_t now, Command &out);
+            size_t size() const;
+            void clear() { entries_ = {}; }
+
+            // A relay of `sequence` was heard. If `target` is non-zero it must be one of the packet's
+            // targets (batched packets carry several). Calls `on_ack(target, sent_at)` for every entry it clears.
+            template<typename F>
+            size_t acknowledge(uint8_t sequence, uint32_t target, F &&on_ack)
+            {
+                bool matched = target == 0;
+                for (const auto &entry : entries_)
+                {
+                    if (entry.active && entry.sequence == sequence && entry.cmd.target == target)
+                        matched = true;
+                }
+                if (!matched)
+                    return 0;
+
+                size_t acked = 0;
+                for (auto &entry : entries_)
+                {
+                    if (!entry.active || entry.sequence != sequence)
+                        continue;
+                    entry.active = false;
+                    on_ack(entry.cmd.target, entry.sent_at);
+                    acked++;
+                }
+                return acked;
+            }
+
+        protected:
+            struct Entry
+            {
+                Command cmd;
+                uint32_t sent_at{0};
+                uint32_t due{0};
+                uint8_t sequence{0};
+                bool active{false};
+            };
+
+            std::array<Entry, CAPACITY> entries_{};
+        };
+    } // namespace fastcon
+} // namespace esphome
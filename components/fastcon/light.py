@@ -3,7 +3,7 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import light
-from esphome.const import CONF_LIGHT_ID, CONF_OUTPUT_ID
+from esphome.const import CONF_LIGHT_ID, CONF_OUTPUT_ID, CONF_TYPE
 
 from .fastcon_controller import FastconController
 
@@ -11,27 +11,68 @@ DEPENDENCIES = ["esp32_ble"]
 AUTO_LOAD = ["light"]
 
 CONF_CONTROLLER_ID = "controller_id"
+CONF_GROUP_ID = "group_id"
+CONF_DEBOUNCE = "debounce"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_TRANSITION_TARGET = "transition_target"
+CONF_RELAY_HOPS = "relay_hops"
 
 fastcon_ns = cg.esphome_ns.namespace("fastcon")
 FastconLight = fastcon_ns.class_("FastconLight", light.LightOutput, cg.Component)
+LightType = fastcon_ns.enum("LightType", is_class=True)
+LIGHT_TYPES = {
+    "brightness": LightType.BRIGHTNESS,
+    "cwww": LightType.CWWW,
+    "rgbcw": LightType.RGBCW,
+}
 
 CONFIG_SCHEMA = cv.All(
     light.BRIGHTNESS_ONLY_LIGHT_SCHEMA.extend(
         {
             cv.GenerateID(CONF_OUTPUT_ID): cv.declare_id(FastconLight),
-            cv.Required(CONF_LIGHT_ID): cv.int_range(min=1, max=255),
+            # A light with only a group_id controls the whole group with one packet;
+            # with both, group_id is the group the light was paired into.
+            cv.Optional(CONF_LIGHT_ID): cv.int_range(min=1, max=255),
+            cv.Optional(CONF_GROUP_ID): cv.int_range(min=1, max=255),
+            # Color modes of the bulb; the light data encoder is specialised for them
+            cv.Optional(CONF_TYPE, default="rgbcw"): cv.enum(LIGHT_TYPES, lower=True),
             cv.Optional(CONF_CONTROLLER_ID, default="fastcon_controller"): cv.use_id(
                 FastconController
             ),
+            # Quiet time after the last state change before a command is sent
+            cv.Optional(CONF_DEBOUNCE, default="100ms"): cv.All(
+                cv.positive_time_period_milliseconds,
+                cv.Range(max=cv.TimePeriod(seconds=60)),
+            ),
+            # Minimum time between two commands to this light
+            cv.Optional(CONF_MIN_INTERVAL, default="300ms"): cv.All(
+                cv.positive_time_period_milliseconds,
+                cv.Range(max=cv.TimePeriod(seconds=60)),
+            ),
+            # Send a transition's target right away and let the bulb fade
+            cv.Optional(CONF_TRANSITION_TARGET, default=True): cv.boolean,
+            # Mesh hops between the controller and the bulb; 0 = in direct range, not relayed
+            cv.Optional(CONF_RELAY_HOPS): cv.int_range(min=0, max=8),
         }
-    ).extend(cv.COMPONENT_SCHEMA)
+    ).extend(cv.COMPONENT_SCHEMA),
+    cv.has_at_least_one_key(CONF_LIGHT_ID, CONF_GROUP_ID),
 )
 
 
 async def to_code(config):
-    var = cg.new_Pvariable(config[CONF_OUTPUT_ID], config[CONF_LIGHT_ID])
+    var = cg.new_Pvariable(config[CONF_OUTPUT_ID], config.get(CONF_LIGHT_ID, 0))
     await cg.register_component(var, config)
     await light.register_light(var, config)
 
+    if CONF_GROUP_ID in config:
+        cg.add(var.set_group_id(config[CONF_GROUP_ID]))
+
+    cg.add(var.set_light_type(config[CONF_TYPE]))
+    cg.add(var.set_debounce(config[CONF_DEBOUNCE]))
+    cg.add(var.set_min_interval(config[CONF_MIN_INTERVAL]))
+    cg.add(var.set_transition_target(config[CONF_TRANSITION_TARGET]))
+    if CONF_RELAY_HOPS in config:
+        cg.add(var.set_relay_hops(config[CONF_RELAY_HOPS]))
+
     controller = await cg.get_variable(config[CONF_CONTROLLER_ID])
     cg.add(var.set_controller(controller))
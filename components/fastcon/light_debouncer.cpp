@@ -0,0 +1,105 @@
+#include "light_debouncer.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        uint16_t LightDebouncer::add(uint32_t target, uint16_t debounce, uint16_t min_interval)
+        {
+            if (slots_.size() >= MAX_LIGHTS)
+                return INVALID_INDEX;
+
+            Slot slot{};
+            slot.target = target;
+            slot.debounce = debounce;
+            slot.min_interval = min_interval;
+            slots_.push_back(slot);
+            return static_cast<uint16_t>(slots_.size() - 1);
+        }
+
+        void LightDebouncer::update(uint16_t index, const LightData &state, uint32_t now)
+        {
+            if (index >= slots_.size())
+                return;
+
+            Slot &slot = slots_[index];
+            slot.state = state;
+            slot.changed_at = now;
+            if (!slot.pending)
+            {
+                slot.pending = true;
+                pending_count_++;
+            }
+
+            // Every change restarts the debounce; the minimum interval only counts if it is still running
+            slot.deadline = now + slot.debounce;
+            const uint32_t interval_end = slot.sent_at + slot.min_interval;
+            if (now - slot.sent_at < slot.min_interval && static_cast<int32_t>(interval_end - slot.deadline) > 0)
+                slot.deadline = interval_end;
+
+            ready_.clear(index);
+            schedule(index, now);
+        }
+
+        void LightDebouncer::mark_sent(uint16_t index, uint32_t now)
+        {
+            if (index >= slots_.size())
+                return;
+
+            Slot &slot = slots_[index];
+            slot.sent_at = now;
+            ready_.clear(index);
+            if (slot.pending)
+            {
+                slot.pending = false;
+                pending_count_--;
+            }
+        }
+
+        void LightDebouncer::schedule(uint16_t index, uint32_t now)
+        {
+            const Slot &slot = slots_[index];
+            if (static_cast<int32_t>(now - slot.deadline) >= 0)
+            {
+                ready_.set(index);
+                return;
+            }
+
+            // The bucket expires at the first tick boundary at or after the deadline
+            const int32_t until = static_cast<int32_t>(slot.deadline - wheel_time_);
+            size_t ticks = until <= 0 ? 1 : (static_cast<uint32_t>(until) + TICK_MS - 1) / TICK_MS;
+            if (ticks >= WHEEL_SIZE)
+                ticks = WHEEL_SIZE - 1;
+            wheel_[(wheel_pos_ + ticks) % WHEEL_SIZE].set(index);
+        }
+
+        void LightDebouncer::advance(uint32_t now)
+        {
+            uint32_t ticks = (now - wheel_time_) / TICK_MS;
+            if (ticks == 0)
+                return;
+
+            // Idle, the buckets hold only stale bits and the wheel just moves on. After a gap longer
+            // than the wheel, every bucket is visited once.
+            const uint32_t skip = pending_count_ == 0 ? ticks : (ticks > WHEEL_SIZE ? ticks - WHEEL_SIZE : 0);
+            wheel_time_ += skip * TICK_MS;
+            wheel_pos_ = (wheel_pos_ + skip) % WHEEL_SIZE;
+
+            for (ticks -= skip; ticks > 0; ticks--)
+            {
+                wheel_pos_ = (wheel_pos_ + 1) % WHEEL_SIZE;
+                wheel_time_ += TICK_MS;
+
+                const LightMask expired = wheel_[wheel_pos_];
+                wheel_[wheel_pos_] = LightMask();
+                expired.for_each([&](uint16_t index)
+                                 {
+                                     // Sent directly or already ready since it was filed here
+                                     if (slots_[index].pending)
+                                         schedule(index, now);
+                                     return true;
+                                 });
+            }
+        }
+    } // namespace fastcon
+} // namespace esphome
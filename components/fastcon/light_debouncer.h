@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "protocol.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Debounce and rate-limit state of every light, owned by the controller so a single pass in its
+        // loop() replaces one loop() per light. A light keeps only its index into the table; each slot
+        // holds the logical light data, never an encoded packet.
+        //
+        // Pending lights wait in a timer wheel until their deadline (end of the debounce and of the
+        // minimum interval), then move to a ready bitmap that is sent in index order. Only lights
+        // whose deadline has expired are visited, and an idle table costs nothing.
+        class LightDebouncer
+        {
+        public:
+            static const size_t MAX_LIGHTS = 256;
+            static const uint16_t INVALID_INDEX = 0xffff;
+            // Wheel resolution and size; deadlines further out than the wheel spans are re-filed
+            static const uint32_t TICK_MS = 16;
+            static const size_t WHEEL_SIZE = 32;
+
+            // Registers a light sending to `target`; returns its index, INVALID_INDEX if the table is full
+            uint16_t add(uint32_t target, uint16_t debounce, uint16_t min_interval);
+            // A new state for light `index`, sent once it has been stable for the debounce time
+            void update(uint16_t index, const LightData &state, uint32_t now);
+            // The light's state went out directly (transition target); drops anything pending
+            void mark_sent(uint16_t index, uint32_t now);
+
+            uint32_t target(uint16_t index) const { return slots_[index].target; }
+            bool pending() const { return pending_count_ > 0; }
+            size_t size() const { return slots_.size(); }
+            void reserve(size_t lights) { slots_.reserve(lights); }
+
+            // Hands every light whose deadline has passed to `send(target, state, delay)`, lowest index
+            // first; a light stays ready if `send` returns false (queue full) and the pass stops
+            template<typename F>
+            void flush(uint32_t now, F &&send)
+            {
+                advance(now);
+                if (pending_count_ == 0)
+                    return;
+                ready_.for_each([&](uint16_t index)
+                                {
+                                    Slot &slot = slots_[index];
+                                    if (!send(slot.target, slot.state, now - slot.changed_at))
+                                        return false;
+                                    ready_.clear(index);
+                                    slot.sent_at = now;
+                                    slot.pending = false;
+                                    pending_count_--;
+                                    return true;
+                                });
+            }
+
+        protected:
+            // One bit per light index, scanned with count-trailing-zeros
+            struct LightMask
+            {
+                std::array<uint32_t, MAX_LIGHTS / 32> words{};
+
+                void set(uint16_t index) { words[index >> 5] |= 1u << (index & 31); }
+                void clear(uint16_t index) { words[index >> 5] &= ~(1u << (index & 31)); }
+
+                // Calls `f(index)` for every set bit in ascending order until it returns false
+                template<typename F>
+                bool for_each(F &&f) const
+                {
+                    for (size_t word = 0; word < words.size(); word++)
+                    {
+                        uint32_t bits = words[word];
+                        while (bits != 0)
+                        {
+                            const uint16_t index = word * 32 + __builtin_ctz(bits);
+                            bits &= bits - 1;
+                            if (!f(index))
+                                return false;
+                        }
+                    }
+                    return true;
+                }
+            };
+
+            // 28 bytes per light
+            struct Slot
+            {
+                uint32_t target;
+                uint32_t changed_at;      // Last update()
+                uint32_t sent_at;         // Last state handed to the controller
+                uint32_t deadline;        // Earliest time the pending state may be sent
+                uint16_t debounce;
+                uint16_t min_interval;
+                LightData state;
+                bool pending;
+            };
+            static_assert(sizeof(Slot) == 28, "Update the slot size here and in OPTIMIZATION.md");
+
+            // Moves the wheel up to `now` and marks the lights whose deadline has passed as ready
+            void advance(uint32_t now);
+            // Files a pending light under its deadline, or marks it ready if the deadline has passed
+            void schedule(uint16_t index, uint32_t now);
+
+            std::vector<Slot> slots_;
+            uint16_t pending_count_{0};
+
+            // Bucket i holds the lights due in the tick that starts at wheel_time_ + (i - wheel_pos_) * TICK_MS.
+            // Stale bits of lights that were sent or rescheduled are skipped when their bucket expires.
+            std::array<LightMask, WHEEL_SIZE> wheel_{};
+            uint32_t wheel_time_{0};
+            uint8_t wheel_pos_{0};
+            LightMask ready_;
+        };
+    } // namespace fastcon
+} // namespace esphome
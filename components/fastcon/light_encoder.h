@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "esphome/components/light/color_mode.h"
+#include "esphome/components/light/light_color_values.h"
+#include "protocol.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Color capabilities of a Fastcon light, chosen per light in light.py
+        enum class LightType : uint8_t
+        {
+            BRIGHTNESS, // Dimmable only
+            CWWW,       // Tunable white, controlled by color temperature
+            RGBCW       // RGB, white and cold/warm white
+        };
+
+        // ColorCapability bits handled by the encoder of each light type
+        static constexpr uint8_t CAPABILITY_ON_OFF = static_cast<uint8_t>(light::ColorCapability::ON_OFF);
+        static constexpr uint8_t CAPABILITY_BRIGHTNESS = static_cast<uint8_t>(light::ColorCapability::BRIGHTNESS);
+        static constexpr uint8_t CAPABILITY_WHITE = static_cast<uint8_t>(light::ColorCapability::WHITE);
+        static constexpr uint8_t CAPABILITY_COLOR_TEMPERATURE = static_cast<uint8_t>(light::ColorCapability::COLOR_TEMPERATURE);
+        static constexpr uint8_t CAPABILITY_COLD_WARM_WHITE = static_cast<uint8_t>(light::ColorCapability::COLD_WARM_WHITE);
+        static constexpr uint8_t CAPABILITY_RGB = static_cast<uint8_t>(light::ColorCapability::RGB);
+
+        static constexpr uint8_t BRIGHTNESS_CAPABILITIES = CAPABILITY_ON_OFF | CAPABILITY_BRIGHTNESS;
+        static constexpr uint8_t CWWW_CAPABILITIES = BRIGHTNESS_CAPABILITIES | CAPABILITY_COLOR_TEMPERATURE;
+        static constexpr uint8_t RGBCW_CAPABILITIES = BRIGHTNESS_CAPABILITIES | CAPABILITY_WHITE | CAPABILITY_COLD_WARM_WHITE | CAPABILITY_RGB;
+        static constexpr uint8_t ALL_CAPABILITIES = RGBCW_CAPABILITIES | CAPABILITY_COLOR_TEMPERATURE;
+
+        inline uint8_t color_channel(float value) { return static_cast<uint8_t>(value * 255.0f); }
+
+        // Writes the light data for `values` into `out`: {0x00} when off, {brightness} in white mode, otherwise
+        // {0x80 | brightness, blue, red, green, warm, cold}. Code for capabilities outside `Capabilities` is
+        // compiled out, so a light only pays for the color modes it has.
+        template<uint8_t Capabilities>
+        void encode_light_data(const light::LightColorValues &values, LightData &out)
+        {
+            if (!values.is_on())
+            {
+                out.bytes[0] = 0x00;
+                out.length = 1;
+                return;
+            }
+
+            const uint8_t mode = static_cast<uint8_t>(values.get_color_mode()) & Capabilities;
+            const uint8_t brightness = static_cast<uint8_t>(std::min(values.get_brightness() * 127.0f, 127.0f));
+            if constexpr ((Capabilities & CAPABILITY_WHITE) != 0)
+            {
+                if (mode & CAPABILITY_WHITE)
+                {
+                    out.bytes[0] = brightness;
+                    out.length = 1;
+                    return;
+                }
+            }
+
+            out.bytes = {static_cast<uint8_t>(0x80 + brightness), 0, 0, 0, 0, 0};
+            out.length = MAX_LIGHT_DATA_SIZE;
+            if constexpr ((Capabilities & CAPABILITY_RGB) != 0)
+            {
+                if (mode & CAPABILITY_RGB)
+                {
+                    out.bytes[1] = color_channel(values.get_blue());
+                    out.bytes[2] = color_channel(values.get_red());
+                    out.bytes[3] = color_channel(values.get_green());
+                }
+            }
+            if constexpr ((Capabilities & CAPABILITY_COLD_WARM_WHITE) != 0)
+            {
+                if (mode & CAPABILITY_COLD_WARM_WHITE)
+                {
+                    out.bytes[4] = color_channel(values.get_warm_white());
+                    out.bytes[5] = color_channel(values.get_cold_white());
+                }
+            }
+            if constexpr ((Capabilities & CAPABILITY_COLOR_TEMPERATURE) != 0)
+            {
+                if (mode & CAPABILITY_COLOR_TEMPERATURE)
+                {
+                    // Whole mireds index the integer table
+                    const float mireds = std::min(std::max(values.get_color_temperature(), 0.0f), static_cast<float>(MAX_MIREDS));
+                    color_temperature_channels(static_cast<uint16_t>(mireds + 0.5f), out.bytes[4], out.bytes[5]);
+                }
+            }
+        }
+
+        using LightEncoder = void (*)(const light::LightColorValues &values, LightData &out);
+
+        inline LightEncoder light_encoder(LightType type)
+        {
+            switch (type)
+            {
+            case LightType::BRIGHTNESS:
+                return &encode_light_data<BRIGHTNESS_CAPABILITIES>;
+            case LightType::CWWW:
+                return &encode_light_data<CWWW_CAPABILITIES>;
+            case LightType::RGBCW:
+                break;
+            }
+            return &encode_light_data<RGBCW_CAPABILITIES>;
+        }
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include "mesh_timing.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        void MeshTiming::learn(uint8_t light_id, uint32_t delay)
+        {
+            if (!learn_)
+                return;
+
+            // Smoothed over about four acknowledgements; single late relays do not dominate
+            const uint16_t sample = std::min<uint32_t>(delay, MAX_RELAY_TIME_MS);
+            Light &light = lights_[light_id];
+            light.learned = light.learned == 0 ? std::max<uint16_t>(sample, 1) : (light.learned * 3 + sample + 2) / 4;
+        }
+
+        uint16_t MeshTiming::relay_time(uint8_t light_id) const
+        {
+            const Light &light = lights_[light_id];
+            uint32_t time = 0;
+            if (light.hops != UNKNOWN_HOPS)
+                time = static_cast<uint32_t>(light.hops) * hop_time_;
+            if (learn_)
+                time = std::max<uint32_t>(time, light.learned);
+            return std::min<uint32_t>(time, MAX_RELAY_TIME_MS);
+        }
+
+        void MeshTiming::refill(uint32_t now)
+        {
+            const int32_t capacity = static_cast<int32_t>(budget_ms_) * 1000;
+            if (!filled_)
+            {
+                tokens_ = capacity;
+                last_refill_ = now;
+                filled_ = true;
+                return;
+            }
+
+            // Every ms of real time earns budget_ms_ µs of air time
+            const uint32_t elapsed = std::min<uint32_t>(now - last_refill_, 1000);
+            last_refill_ = now;
+            tokens_ = std::min<int32_t>(tokens_ + static_cast<int32_t>(elapsed * budget_ms_), capacity);
+        }
+
+        bool MeshTiming::may_transmit(uint32_t now)
+        {
+            if (budget_ms_ == 0)
+                return true;
+            refill(now);
+            return tokens_ > 0;
+        }
+
+        void MeshTiming::consume(uint32_t now, uint16_t air_time)
+        {
+            if (budget_ms_ == 0)
+                return;
+            refill(now);
+            tokens_ -= static_cast<int32_t>(air_time) * 1000;
+        }
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // How long the mesh needs to relay a packet to each light, and how much air time the controller
+        // may use. The relay time of a light comes from its configured hop count or, when learning is
+        // enabled, from how long relays of its packets take to be heard. The advertiser leaves that much
+        // time after a packet before the next one, so its own traffic does not collide with the bulbs
+        // relaying it.
+        //
+        // The budget is a token bucket refilled at `percent` of real time and holding up to one
+        // second's worth: a burst may use the full radio until the bucket is empty, then the average
+        // stays within the budget. Consumer side only (consumer_mutex_ held).
+        class MeshTiming
+        {
+        public:
+            static const uint8_t UNKNOWN_HOPS = 0xff;
+            static const uint8_t MAX_HOPS = 8;
+            // Upper bound of a relay time, so a bad estimate cannot stall the advertiser
+            static const uint16_t MAX_RELAY_TIME_MS = 250;
+
+            void configure(uint16_t hop_time, bool learn)
+            {
+                hop_time_ = hop_time;
+                learn_ = learn;
+            }
+            // Share of every second the controller may advertise (1-100)
+            void set_budget(uint8_t percent) { budget_ms_ = percent >= 100 ? 0 : percent * 10; }
+
+            // Distance of a light from the controller in relay hops; 0 = in direct range, its packets
+            // need no relaying
+            void set_hops(uint8_t light_id, uint8_t hops) { lights_[light_id].hops = hops; }
+            bool direct(uint8_t light_id) const { return lights_[light_id].hops == 0; }
+            // The first relay of a packet for `light_id` was heard `delay` ms after it was encoded
+            void learn(uint8_t light_id, uint32_t delay);
+            // Expected time for a packet to reach the light through the mesh; 0 if nothing is known
+            uint16_t relay_time(uint8_t light_id) const;
+
+            // Air time allowed per second in ms, 0 if unlimited
+            uint16_t budget() const { return budget_ms_; }
+            // False while the budget is used up
+            bool may_transmit(uint32_t now);
+            // Charges an advertisement of `air_time` ms to the budget
+            void consume(uint32_t now, uint16_t air_time);
+
+        protected:
+            void refill(uint32_t now);
+
+            struct Light
+            {
+                uint16_t learned{0};  // Smoothed relay delay, 0 until the first acknowledgement
+                uint8_t hops{UNKNOWN_HOPS};
+            };
+            std::array<Light, 256> lights_{};
+            uint16_t hop_time_{0};
+            bool learn_{false};
+
+            // Budget in ms of air time per second (0 = unlimited); tokens in µs, may go negative by
+            // the air time of the last advertisement
+            uint16_t budget_ms_{0};
+            int32_t tokens_{0};
+            uint32_t last_refill_{0};
+            bool filled_{false};
+        };
+    } // namespace fastcon
+} // namespace esphome
@@ -5,56 +5,310 @@ namespace esphome
 {
     namespace fastcon
     {
-        std::vector<uint8_t> get_rf_payload(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data)
+        static_assert(RF_BUFFER_SIZE <= WHITENING_KEYSTREAM_SIZE, "whitening keystream must cover a full RF frame");
+
+        static size_t rf_payload_size(size_t addr_len, size_t data_len)
+        {
+            return RF_DATA_OFFSET + addr_len + data_len + 2;
+        }
+
+        // Builds the RF frame into `rf` and whitens it in place; returns the frame length
+        static size_t whitened_rf_payload(const uint8_t *addr, size_t addr_len, const uint8_t *data, size_t data_len, uint8_t *rf, size_t rf_size)
+        {
+            size_t rf_len = get_rf_payload(addr, addr_len, data, data_len, rf, rf_size);
+            if (rf_len == 0)
+                return 0;
+
+            // Apply whitening to the payload, falling back to the generator for oversized frames
+            if (!whitening_encode_default(rf, rf_len))
+            {
+                WhiteningContext context;
+                whitening_init(DEFAULT_WHITENING_SEED, context);
+                whitening_encode(rf, rf_len, context);
+            }
+            return rf_len;
+        }
+
+        void CachedLightState::set(const uint8_t *data, size_t len)
+        {
+            *this = CachedLightState{};
+            if (len == 0 || len > MAX_LIGHT_DATA_SIZE)
+                return;
+
+            // A single byte is off (0x00) or a white-mode brightness; longer data carries the on bit
+            bool is_on = len == 1 ? data[0] != 0 : (data[0] & 0x80) != 0;
+            flags = KNOWN | (is_on ? ON : 0) | static_cast<uint8_t>(len);
+            brightness = data[0] & 0x7f;
+
+            uint8_t *colors[] = {&blue, &red, &green, &warm, &cold};
+            for (size_t i = 1; i < len; i++)
+                *colors[i - 1] = data[i];
+        }
+
+        bool CachedLightState::matches(const uint8_t *data, size_t len) const
+        {
+            if (!known())
+                return false;
+            CachedLightState other;
+            other.set(data, len);
+            return *this == other;
+        }
+
+#ifdef FASTCON_COMPACT_ENCODER
+        static uint8_t color_temperature_level(uint16_t steps)
+        {
+            return steps * 255 / (MAX_MIREDS - MIN_MIREDS);
+        }
+#else
+        // One byte per mired step; both channels share the table, read from opposite ends
+        struct ColorTemperatureTable
         {
-            const size_t data_offset = 0x12;
+            uint8_t values[MAX_MIREDS - MIN_MIREDS + 1];
+
+            constexpr ColorTemperatureTable() : values()
+            {
+                for (int i = 0; i <= MAX_MIREDS - MIN_MIREDS; i++)
+                {
+                    values[i] = static_cast<uint8_t>(i * 255 / (MAX_MIREDS - MIN_MIREDS));
+                }
+            }
+        };
+
+        static constexpr ColorTemperatureTable COLOR_TEMPERATURE_TABLE{};
+
+        static uint8_t color_temperature_level(uint16_t steps)
+        {
+            return COLOR_TEMPERATURE_TABLE.values[steps];
+        }
+#endif
+
+        void color_temperature_channels(uint16_t mireds, uint8_t &warm, uint8_t &cold)
+        {
+            const uint16_t clamped = std::min(std::max(mireds, MIN_MIREDS), MAX_MIREDS);
+            warm = color_temperature_level(MAX_MIREDS - clamped);
+            cold = color_temperature_level(clamped - MIN_MIREDS);
+        }
+
+        size_t write_control_record(uint8_t *buf, size_t buf_size, size_t offset, uint8_t type, uint8_t addr, const uint8_t *data, size_t len)
+        {
+            if (offset + control_record_size(len) > buf_size)
+                return 0;
+
+            buf[offset] = type | (((0xfffffff & (len + 1)) << 4));
+            buf[offset + 1] = addr;
+            std::copy(data, data + len, buf + offset + 2);
+            return offset + control_record_size(len);
+        }
+
+        size_t get_rf_payload(const uint8_t *addr, size_t addr_len, const uint8_t *data, size_t data_len, uint8_t *out, size_t out_size)
+        {
+            const size_t data_offset = RF_DATA_OFFSET;
             const size_t inverse_offset = 0x0f;
-            const size_t result_data_size = data_offset + addr.size() + data.size();
+            const size_t result_data_size = data_offset + addr_len + data_len;
 
-            // Create result buffer including space for checksum
-            std::vector<uint8_t> resultbuf(result_data_size + 2, 0);
+            // Result buffer includes space for checksum
+            if (out_size < result_data_size + 2)
+                return 0;
+            std::fill(out, out + result_data_size + 2, 0);
 
             // Set hardcoded values
-            resultbuf[0x0f] = 0x71;
-            resultbuf[0x10] = 0x0f;
-            resultbuf[0x11] = 0x55;
+            out[0x0f] = 0x71;
+            out[0x10] = 0x0f;
+            out[0x11] = 0x55;
 
             // Copy address in reverse
-            for (size_t i = 0; i < addr.size(); i++)
+            for (size_t i = 0; i < addr_len; i++)
             {
-                resultbuf[data_offset + addr.size() - i - 1] = addr[i];
+                out[data_offset + addr_len - i - 1] = addr[i];
             }
 
             // Copy data
-            std::copy(data.begin(), data.end(), resultbuf.begin() + data_offset + addr.size());
+            std::copy(data, data + data_len, out + data_offset + addr_len);
 
             // Reverse bytes in specified range
-            for (size_t i = inverse_offset; i < inverse_offset + addr.size() + 3; i++)
+            for (size_t i = inverse_offset; i < inverse_offset + addr_len + 3; i++)
             {
-                resultbuf[i] = reverse_8(resultbuf[i]);
+                out[i] = reverse_8(out[i]);
             }
 
             // Add CRC
-            uint16_t crc = crc16(addr, data);
-            resultbuf[result_data_size] = crc & 0xFF;
-            resultbuf[result_data_size + 1] = (crc >> 8) & 0xFF;
+            uint16_t crc = crc16(addr, addr_len, data, data_len);
+            out[result_data_size] = crc & 0xFF;
+            out[result_data_size + 1] = (crc >> 8) & 0xFF;
+
+            return result_data_size + 2;
+        }
+
+        bool prepare_payload(const uint8_t *addr, size_t addr_len, const uint8_t *data, size_t data_len, PacketBuffer &out)
+        {
+            out.clear();
+
+            uint8_t rf[RF_BUFFER_SIZE];
+            size_t rf_len = get_rf_payload(addr, addr_len, data, data_len, rf, sizeof(rf));
+            if (rf_len == 0)
+                return false;
 
+            // Only the portion after 0xf bytes is transmitted, so only that part needs whitening
+            whitening_encode_default(rf + RF_PAYLOAD_OFFSET, rf_len - RF_PAYLOAD_OFFSET, RF_PAYLOAD_OFFSET);
+            return out.assign(rf + RF_PAYLOAD_OFFSET, rf_len - RF_PAYLOAD_OFFSET);
+        }
+
+        std::vector<uint8_t> get_rf_payload(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data)
+        {
+            std::vector<uint8_t> resultbuf(rf_payload_size(addr.size(), data.size()));
+            get_rf_payload(addr.data(), addr.size(), data.data(), data.size(), resultbuf.data(), resultbuf.size());
             return resultbuf;
         }
 
         std::vector<uint8_t> prepare_payload(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data)
         {
-            auto payload = get_rf_payload(addr, data);
+            std::vector<uint8_t> payload(rf_payload_size(addr.size(), data.size()));
+            whitened_rf_payload(addr.data(), addr.size(), data.data(), data.size(), payload.data(), payload.size());
 
-            // Initialize whitening
-            WhiteningContext context;
-            whitening_init(0x25, context);
+            // Return only the portion after 0xf bytes
+            payload.erase(payload.begin(), payload.begin() + RF_PAYLOAD_OFFSET);
+            return payload;
+        }
+
+        bool encode_mesh_command(uint8_t type, uint32_t addr, uint8_t sequence, const std::array<uint8_t, 4> &mesh_key,
+                                 const uint8_t *data, size_t len, PacketBuffer &out, bool forward)
+        {
+            if (len > MAX_COMMAND_DATA_SIZE)
+            {
+                out.clear();
+                return false;
+            }
 
-            // Apply whitening to the payload
-            whitening_encode(payload, context);
+            // Create command body with header
+            std::array<uint8_t, MAX_COMMAND_BODY_SIZE> body{};
+            const size_t body_len = len + COMMAND_HEADER_SIZE;
+            uint8_t i2 = (addr / 256);
 
-            // Return only the portion after 0xf bytes
-            return std::vector<uint8_t>(payload.begin() + 0xf, payload.end());
+            // Construct header
+            body[0] = (i2 & 0b1111) | ((type & 0b111) << 4) | (forward ? 0x80 : 0);
+            body[1] = sequence;
+            body[2] = mesh_key[3]; // Safe key
+
+            // Copy data
+            std::copy(data, data + len, body.begin() + COMMAND_HEADER_SIZE);
+
+            // Calculate checksum
+            uint8_t checksum = 0;
+            for (size_t i = 0; i < body_len; i++)
+            {
+                if (i != 3)
+                {
+                    checksum = checksum + body[i];
+                }
+            }
+            body[3] = checksum;
+
+            // Encrypt header and data
+            for (size_t i = 0; i < COMMAND_HEADER_SIZE; i++)
+            {
+                body[i] = DEFAULT_ENCRYPT_KEY[i & 3] ^ body[i];
+            }
+
+            for (size_t i = 0; i < len; i++)
+            {
+                body[COMMAND_HEADER_SIZE + i] = mesh_key[i & 3] ^ body[COMMAND_HEADER_SIZE + i];
+            }
+
+            // Prepare the final payload with RF protocol formatting
+            return prepare_payload(DEFAULT_BLE_FASTCON_ADDRESS.data(), DEFAULT_BLE_FASTCON_ADDRESS.size(), body.data(), body_len, out);
+        }
+
+        size_t write_adv_frame(const PacketBuffer &packet, uint8_t *raw)
+        {
+            memcpy(raw, ADV_HEADER_TEMPLATE.data(), ADV_HEADER_SIZE);
+            // The manufacturer data length leaves out one byte, as the bulbs have always been sent it
+            raw[ADV_HEADER_LENGTH_OFFSET] = packet.size() + 2;
+            memcpy(raw + ADV_HEADER_SIZE, packet.data(), packet.size());
+            return ADV_HEADER_SIZE + packet.size();
+        }
+
+        const uint8_t *find_manufacturer_data(const uint8_t *adv, size_t len, uint16_t company_id, size_t &data_len)
+        {
+            // Walk the AD structures: [length][type][data...]
+            for (size_t i = 0; i + 1 < len && adv[i] != 0; i += adv[i] + 1)
+            {
+                const size_t field_len = adv[i];
+                if (i + 1 + field_len > len)
+                    break;
+                const uint8_t *field = &adv[i + 1];
+                if (field_len < 3 || field[0] != 0xff || field[1] != (company_id & 0xFF) || field[2] != ((company_id >> 8) & 0xFF))
+                    continue;
+
+                data_len = field_len - 3;
+                return field + 3;
+            }
+            return nullptr;
+        }
+
+        bool parse_payload(const uint8_t *payload, size_t len, const uint8_t *addr, size_t addr_len, uint8_t *body,
+                           size_t body_size, size_t &body_len)
+        {
+            const size_t header_len = RF_DATA_OFFSET - RF_PAYLOAD_OFFSET;
+            uint8_t rf[MAX_RF_PAYLOAD_SIZE];
+            if (len < header_len + addr_len + 2 || len > sizeof(rf))
+                return false;
+            memcpy(rf, payload, len);
+            // Whitening is an XOR with the keystream, so applying it again restores the frame
+            whitening_encode_default(rf, len, RF_PAYLOAD_OFFSET);
+
+            // Fixed header bytes and the (reversed) address are sent bit-reversed
+            static const uint8_t HEADER[] = {0x71, 0x0f, 0x55};
+            for (size_t i = 0; i < header_len; i++)
+            {
+                if (reverse_8(rf[i]) != HEADER[i])
+                    return false;
+            }
+            for (size_t i = 0; i < addr_len; i++)
+            {
+                if (reverse_8(rf[header_len + addr_len - i - 1]) != addr[i])
+                    return false;
+            }
+
+            const uint8_t *data = rf + header_len + addr_len;
+            const size_t data_len = len - header_len - addr_len - 2;
+            const uint16_t crc = rf[len - 2] | (rf[len - 1] << 8);
+            if (data_len > body_size || crc16(addr, addr_len, data, data_len) != crc)
+                return false;
+
+            memcpy(body, data, data_len);
+            body_len = data_len;
+            return true;
+        }
+
+        bool decode_command(const uint8_t *body, size_t len, const std::array<uint8_t, 4> &mesh_key, DecodedCommand &out)
+        {
+            if (len < COMMAND_HEADER_SIZE || len - COMMAND_HEADER_SIZE > MAX_COMMAND_DATA_SIZE)
+                return false;
+
+            uint8_t plain[MAX_COMMAND_BODY_SIZE];
+            for (size_t i = 0; i < COMMAND_HEADER_SIZE; i++)
+                plain[i] = body[i] ^ DEFAULT_ENCRYPT_KEY[i & 3];
+            for (size_t i = COMMAND_HEADER_SIZE; i < len; i++)
+                plain[i] = body[i] ^ mesh_key[(i - COMMAND_HEADER_SIZE) & 3];
+
+            // Packets of other meshes carry a different safe key
+            if (plain[2] != mesh_key[3])
+                return false;
+
+            uint8_t checksum = 0;
+            for (size_t i = 0; i < len; i++)
+            {
+                if (i != 3)
+                    checksum += plain[i];
+            }
+            if (checksum != plain[3])
+                return false;
+
+            out.addr_high = plain[0] & 0x0f;
+            out.type = (plain[0] >> 4) & 0x07;
+            out.forward = (plain[0] & 0x80) != 0;
+            out.sequence = plain[1];
+            return out.data.assign(plain + COMMAND_HEADER_SIZE, len - COMMAND_HEADER_SIZE);
         }
     } // namespace fastcon
-} // namespace esphome
\ No newline at end of file
+} // namespace esphome
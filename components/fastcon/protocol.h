@@ -3,6 +3,7 @@
 #include <vector>
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include "utils.h"
 
 namespace esphome
@@ -12,7 +13,150 @@ namespace esphome
         static const std::array<uint8_t, 4> DEFAULT_ENCRYPT_KEY = {0x5e, 0x36, 0x7b, 0xc4};
         static const std::array<uint8_t, 3> DEFAULT_BLE_FASTCON_ADDRESS = {0xC1, 0xC2, 0xC3};
 
+        // Legacy advertisement limits: 31 bytes total, of which flags (3) and the
+        // manufacturer data header (4) leave 24 bytes for the RF payload.
+        static const size_t MAX_PACKET_SIZE = 31;
+        static const size_t ADV_HEADER_SIZE = 7;
+        static const size_t MAX_RF_PAYLOAD_SIZE = MAX_PACKET_SIZE - ADV_HEADER_SIZE;
+        // Flags (LE general discoverable, BR/EDR not supported) and the header of manufacturer data 0xfff0;
+        // only the length byte changes from packet to packet
+        static constexpr std::array<uint8_t, ADV_HEADER_SIZE> ADV_HEADER_TEMPLATE = {0x02, 0x01, 0x06, 0x00, 0xff, 0xf0, 0xff};
+        static const size_t ADV_HEADER_LENGTH_OFFSET = 3;
+
+        // RF framing: 0x12 bytes of preamble/header, address, data and a 2-byte CRC.
+        // Everything before RF_PAYLOAD_OFFSET is whitened but not transmitted.
+        static const size_t RF_DATA_OFFSET = 0x12;
+        static const size_t RF_PAYLOAD_OFFSET = 0x0f;
+        static const size_t RF_ADDRESS_SIZE = 3;
+        static const size_t MAX_COMMAND_BODY_SIZE = MAX_RF_PAYLOAD_SIZE - (RF_DATA_OFFSET - RF_PAYLOAD_OFFSET) - RF_ADDRESS_SIZE - 2;
+        static const size_t RF_BUFFER_SIZE = RF_DATA_OFFSET + RF_ADDRESS_SIZE + MAX_COMMAND_BODY_SIZE + 2;
+
+        // Mesh command body: 4-byte encrypted header followed by the command data
+        static const size_t COMMAND_HEADER_SIZE = 4;
+        static const size_t MAX_COMMAND_DATA_SIZE = MAX_COMMAND_BODY_SIZE - COMMAND_HEADER_SIZE;
+
+        // Inner control payload: one or more records of
+        // [type | (data length + 1) << 4][light or group address][data...]
+        static const size_t CONTROL_PAYLOAD_SIZE = 12;
+        static const uint8_t CONTROL_TYPE_SINGLE = 0x02;
+        static const uint8_t CONTROL_TYPE_GROUP = 0x04;
+
+        // Light data as produced by get_light_data(): brightness/on byte, then blue, red, green, warm, cold
+        static const size_t MAX_LIGHT_DATA_SIZE = 6;
+
+        // Fixed-capacity byte buffer used throughout the encoder so a packet never touches the heap
+        template<size_t N>
+        struct FixedBuffer
+        {
+            std::array<uint8_t, N> bytes{};
+            uint8_t length{0};
+
+            static constexpr size_t capacity() { return N; }
+            uint8_t *data() { return bytes.data(); }
+            const uint8_t *data() const { return bytes.data(); }
+            size_t size() const { return length; }
+            bool empty() const { return length == 0; }
+            void clear() { length = 0; }
+
+            bool assign(const uint8_t *src, size_t len)
+            {
+                if (len > N)
+                    return false;
+                memcpy(bytes.data(), src, len);
+                length = len;
+                return true;
+            }
+            bool assign(const std::vector<uint8_t> &src) { return assign(src.data(), src.size()); }
+
+            std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(bytes.begin(), bytes.begin() + length); }
+
+            bool operator==(const FixedBuffer &other) const
+            {
+                return length == other.length && memcmp(bytes.data(), other.bytes.data(), length) == 0;
+            }
+            bool operator!=(const FixedBuffer &other) const { return !(*this == other); }
+        };
+
+        using PacketBuffer = FixedBuffer<MAX_PACKET_SIZE>;
+        using LightData = FixedBuffer<MAX_LIGHT_DATA_SIZE>;
+
+        // Last known logical state of a light ({on, brightness, r, g, b, warm, cold}), decoded from its light data.
+        // The light data length is kept so a brightness-only command never matches a full color command.
+        struct CachedLightState
+        {
+            static const uint8_t KNOWN = 0x80;
+            static const uint8_t ON = 0x40;
+            static const uint8_t LENGTH_MASK = 0x0f;
+
+            uint8_t flags{0}; // KNOWN | ON | light data length
+            uint8_t brightness{0};
+            uint8_t red{0};
+            uint8_t green{0};
+            uint8_t blue{0};
+            uint8_t warm{0};
+            uint8_t cold{0};
+
+            bool known() const { return (flags & KNOWN) != 0; }
+            bool on() const { return (flags & ON) != 0; }
+            void forget() { flags = 0; }
+            // Records light data; empty data (raw or system commands) leaves the state unknown
+            void set(const uint8_t *data, size_t len);
+            bool matches(const uint8_t *data, size_t len) const;
+
+            bool operator==(const CachedLightState &other) const
+            {
+                return flags == other.flags && brightness == other.brightness && red == other.red && green == other.green &&
+                       blue == other.blue && warm == other.warm && cold == other.cold;
+            }
+        };
+
+        // Color temperature range of the bulbs, in mireds
+        static const uint16_t MIN_MIREDS = 153;
+        static const uint16_t MAX_MIREDS = 500;
+        // Light data bytes 4 and 5 for a color temperature (clamped to the range): 0xff/0x00 at MIN_MIREDS,
+        // 0x00/0xff at MAX_MIREDS and linear in between
+        void color_temperature_channels(uint16_t mireds, uint8_t &warm, uint8_t &cold);
+
+        // Bytes taken by one control record carrying `len` bytes of light data
+        inline size_t control_record_size(size_t len) { return len + 2; }
+        // Appends a control record at `offset` in `buf`; returns the new offset, or 0 if it does not fit
+        size_t write_control_record(uint8_t *buf, size_t buf_size, size_t offset, uint8_t type, uint8_t addr, const uint8_t *data, size_t len);
+
+        // Writes the unwhitened RF frame into `out` and returns its length (0 if it does not fit)
+        size_t get_rf_payload(const uint8_t *addr, size_t addr_len, const uint8_t *data, size_t data_len, uint8_t *out, size_t out_size);
+        // Builds the whitened, transmittable payload into `out`; returns false if it does not fit
+        bool prepare_payload(const uint8_t *addr, size_t addr_len, const uint8_t *data, size_t data_len, PacketBuffer &out);
+
         std::vector<uint8_t> get_rf_payload(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data);
         std::vector<uint8_t> prepare_payload(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data);
+
+        // Writes the raw advertisement data for `packet` (header template, then the payload) into `raw`,
+        // which must hold MAX_PACKET_SIZE bytes; returns its length
+        size_t write_adv_frame(const PacketBuffer &packet, uint8_t *raw);
+
+        // Builds the transmittable payload of a mesh command: the 4-byte header (addr / 256, type, forward flag,
+        // sequence, safe key, checksum) and `data` are encrypted, framed and whitened into `out`
+        bool encode_mesh_command(uint8_t type, uint32_t addr, uint8_t sequence, const std::array<uint8_t, 4> &mesh_key,
+                                 const uint8_t *data, size_t len, PacketBuffer &out, bool forward = true);
+
+        // Mesh command recovered from a received advertisement (the inverse of encode_mesh_command())
+        struct DecodedCommand
+        {
+            uint8_t type{0};       // Command type (5 = control)
+            uint8_t sequence{0};
+            uint8_t addr_high{0};  // light_id / 256
+            bool forward{false};
+            FixedBuffer<MAX_COMMAND_DATA_SIZE> data;
+        };
+
+        // Returns the manufacturer specific data for `company_id` in raw advertisement data (without the
+        // company ID), or nullptr if there is none
+        const uint8_t *find_manufacturer_data(const uint8_t *adv, size_t len, uint16_t company_id, size_t &data_len);
+        // Reverses prepare_payload(): de-whitens `payload`, checks the framing, address and CRC and copies
+        // the command body into `body`; returns false if it is not a frame for `addr`
+        bool parse_payload(const uint8_t *payload, size_t len, const uint8_t *addr, size_t addr_len, uint8_t *body,
+                           size_t body_size, size_t &body_len);
+        // Decrypts a command body and checks its checksum and the mesh's safe key
+        bool decode_command(const uint8_t *body, size_t len, const std::array<uint8_t, 4> &mesh_key, DecodedCommand &out);
     } // namespace fastcon
-} // namespace esphome
\ No newline at end of file
+} // namespace esphome
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Smallest power of two >= n
+        constexpr size_t ring_capacity(size_t n, size_t capacity = 1)
+        {
+            return capacity >= n ? capacity : ring_capacity(n, capacity * 2);
+        }
+
+        // Bounded lock-free multi-producer / single-consumer ring buffer. Each slot carries a
+        // sequence number telling producers whether it is free and the consumer whether it is
+        // filled, so push() never blocks and pop() never waits for a producer to finish.
+        // N must be a power of two.
+        template<typename T, size_t N>
+        class MpscRingBuffer
+        {
+            static_assert(N > 0 && (N & (N - 1)) == 0, "ring buffer capacity must be a power of two");
+
+        public:
+            MpscRingBuffer()
+            {
+                for (size_t i = 0; i < N; i++)
+                    slots_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+
+            static constexpr size_t capacity() { return N; }
+
+            // Safe from any task; returns false if the buffer is full
+            bool push(const T &value)
+            {
+                size_t pos = head_.load(std::memory_order_relaxed);
+                Slot *slot;
+                for (;;)
+                {
+                    slot = &slots_[pos & (N - 1)];
+                    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                    if (diff == 0)
+                    {
+                        // Slot is free; claim it (on failure `pos` is reloaded)
+                        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        // Another producer claimed this slot first
+                        pos = head_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                slot->value = value;
+                slot->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Consumer only; returns false if the buffer is empty
+            bool pop(T &out)
+            {
+                size_t pos = tail_.load(std::memory_order_relaxed);
+                Slot &slot = slots_[pos & (N - 1)];
+                size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1) < 0)
+                    return false;
+
+                out = slot.value;
+                // Hand the slot back to producers for the next lap
+                slot.sequence.store(pos + N, std::memory_order_release);
+                tail_.store(pos + 1, std::memory_order_relaxed);
+                return true;
+            }
+
+            // Approximate while producers are active
+            size_t size() const
+            {
+                return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed);
+            }
+            bool empty() const { return size() == 0; }
+
+        protected:
+            struct Slot
+            {
+                std::atomic<size_t> sequence;
+                T value;
+            };
+
+            std::array<Slot, N> slots_;
+            std::atomic<size_t> head_{0}; // Next position to claim for writing
+            std::atomic<size_t> tail_{0}; // Next position to read (written by the consumer only)
+        };
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,156 @@
+#include "esphome/core/log.h"
+#include "scan_scheduler.h"
+#ifdef USE_FASTCON_BLE_TRACKER
+#include "esphome/components/esp32_ble_tracker/esp32_ble_tracker.h"
+#endif
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        static const char *const TAG = "fastcon.scan";
+
+        void ScanScheduler::on_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+        {
+            switch (event)
+            {
+            case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+                if (param->scan_start_cmpl.status == ESP_BT_STATUS_SUCCESS)
+                    scanning_ = true;
+                break;
+
+            case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+                scanning_ = false;
+                break;
+
+            case ESP_GAP_BLE_SCAN_RESULT_EVT:
+                // The scan duration ran out
+                if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT)
+                    scanning_ = false;
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        void ScanScheduler::update(uint32_t now, bool traffic)
+        {
+            if (traffic)
+                last_traffic_ = now;
+
+            switch (state_.load())
+            {
+            case State::IDLE:
+                // Nothing to do unless somebody is actually scanning
+                if (traffic && scanning_)
+                    pause(now);
+                break;
+
+            case State::PAUSED:
+                if (!traffic && now - last_traffic_ >= resume_delay_)
+                {
+                    state_ = State::IDLE;
+                    resume();
+                }
+                else if (traffic && max_pause_ > 0 && now - paused_since_ >= max_pause_)
+                {
+                    // Long burst: give the scanner a window before continuing
+                    if (resume())
+                        open_window(now);
+                    else
+                        state_ = State::IDLE;
+                }
+                else if (scanning_)
+                {
+                    // The scanner's owner restarted it while traffic is pending; stopping it again would
+                    // only fight the owner, so it keeps this scan for a window
+                    ESP_LOGV(TAG, "Scanning restarted while paused, yielding a scan window");
+                    release();
+                    open_window(now);
+                }
+                break;
+
+            case State::WINDOW:
+                if (static_cast<int32_t>(now - window_end_) >= 0)
+                {
+                    state_ = State::IDLE;
+                    if (traffic && scanning_)
+                        pause(now);
+                }
+                break;
+            }
+        }
+
+        void ScanScheduler::open_window(uint32_t now)
+        {
+            window_end_ = now + scan_window_;
+            state_ = State::WINDOW;
+        }
+
+        bool ScanScheduler::pause(uint32_t now)
+        {
+#ifdef USE_FASTCON_BLE_TRACKER
+            auto *tracker = esp32_ble_tracker::global_esp32_ble_tracker;
+            if (tracker != nullptr)
+            {
+                // stop_scan() also clears continuous mode, so the tracker does not restart the scan
+                continuous_ = tracker->get_scan_continuous();
+                tracker->stop_scan();
+            }
+            else
+#endif
+            {
+                esp_err_t err = esp_ble_gap_stop_scanning();
+                if (err != ESP_OK)
+                {
+                    ESP_LOGW(TAG, "Could not pause scanning (err=%d): %s", err, esp_err_to_name(err));
+                    return false;
+                }
+            }
+            // Cleared right away so a late stop event does not make update() stop the scan twice
+            scanning_ = false;
+            paused_since_ = now;
+            state_ = State::PAUSED;
+            ESP_LOGV(TAG, "Paused scanning for queued traffic");
+            return true;
+        }
+
+        void ScanScheduler::release()
+        {
+#ifdef USE_FASTCON_BLE_TRACKER
+            auto *tracker = esp32_ble_tracker::global_esp32_ble_tracker;
+            if (tracker == nullptr)
+                return;
+            tracker->set_scan_continuous(continuous_);
+            // An idle tracker never restarts a scan by itself, continuous or not
+            if (!scanning_)
+                tracker->start_scan();
+#endif
+        }
+
+        bool ScanScheduler::resume()
+        {
+#ifdef USE_FASTCON_BLE_TRACKER
+            auto *tracker = esp32_ble_tracker::global_esp32_ble_tracker;
+            if (tracker != nullptr)
+            {
+                // stop_scan() left the tracker idle, and an idle tracker does not restart even a
+                // continuous scan; restore the mode and start it with the tracker's own parameters
+                tracker->set_scan_continuous(continuous_);
+                tracker->start_scan();
+                ESP_LOGV(TAG, "Resumed scanning through esp32_ble_tracker");
+                return true;
+            }
+#endif
+            esp_err_t err = esp_ble_gap_start_scanning(scan_duration_);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "Could not resume scanning (err=%d): %s", err, esp_err_to_name(err));
+                return false;
+            }
+            ESP_LOGV(TAG, "Resumed scanning");
+            return true;
+        }
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "esp_gap_ble_api.h"
+#include "esphome/core/defines.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Shares the radio between the BLE scanner (owned by esp32_ble_tracker or another component)
+        // and the advertiser. Scanning is paused only while commands are waiting and resumed once the
+        // traffic has settled; during long bursts the advertiser yields a scan window every
+        // `max_pause` so other BLE sensors on the node keep reporting.
+        //
+        // With esp32_ble_tracker (USE_FASTCON_BLE_TRACKER) the scan is paused and resumed through the
+        // tracker, so it knows the scan is stopped and does not restart it in continuous mode. If the
+        // scanner is restarted while paused anyway, its owner wants it: the scheduler hands it a scan
+        // window instead of stopping it again.
+        class ScanScheduler
+        {
+        public:
+            void configure(uint32_t resume_delay, uint32_t max_pause, uint32_t scan_window, uint32_t scan_duration)
+            {
+                resume_delay_ = resume_delay;
+                max_pause_ = max_pause;
+                scan_window_ = scan_window;
+                scan_duration_ = scan_duration;
+            }
+
+            // Called from the GAP event handler to follow the scanner, whoever starts it
+            void on_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+            // Main loop step; `traffic` is true while commands or pairing broadcasts are pending
+            void update(uint32_t now, bool traffic);
+
+            // False during a scan window; safe from any task
+            bool advertising_allowed() const { return state_ != State::WINDOW; }
+            bool scan_paused() const { return state_ == State::PAUSED; }
+
+        protected:
+            enum class State : uint8_t
+            {
+                IDLE,    // Not interfering with the scanner
+                PAUSED,  // Scanner stopped by us for pending traffic
+                WINDOW   // Scanner resumed in the middle of a burst; advertising holds off
+            };
+
+            bool pause(uint32_t now);
+            bool resume();
+            // Gives the scan back to its owner, restarting it only if it is not already running
+            void release();
+            void open_window(uint32_t now);
+
+            std::atomic<State> state_{State::IDLE};
+            // Written from the GAP event handler
+            std::atomic<bool> scanning_{false};
+            uint32_t paused_since_{0};
+            uint32_t last_traffic_{0};
+            uint32_t window_end_{0};
+            // Whether the tracker scanned continuously before the pause; restored when resuming
+            bool continuous_{false};
+
+            uint32_t resume_delay_{500};
+            uint32_t max_pause_{2000};
+            uint32_t scan_window_{200};
+            uint32_t scan_duration_{300};  // Seconds, as passed to esp_ble_gap_start_scanning
+        };
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,144 @@
+#include "esphome/core/log.h"
+#include "command_scheduler.h"
+#include "protocol.h"
+#include "shard_map.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        static const char *const TAG = "fastcon.shard";
+
+        void ShardMap::configure(uint8_t index, uint8_t count, Strategy strategy)
+        {
+            count_ = count == 0 ? 1 : (count > MAX_SHARDS ? MAX_SHARDS : count);
+            index_ = index < count_ ? index : 0;
+            strategy_ = strategy;
+        }
+
+        void ShardMap::set_failover(uint32_t heartbeat_interval, uint32_t timeout)
+        {
+            heartbeat_interval_ = heartbeat_interval;
+            failover_timeout_ = timeout;
+        }
+
+        uint8_t ShardMap::shard_of(uint32_t target) const
+        {
+            const uint32_t id = target & ~TARGET_GROUP_FLAG;
+            if (strategy_ == Strategy::RANGE)
+                return static_cast<uint8_t>(((id & 0xff) * count_) >> 8);
+
+            // Consecutive IDs go to consecutive nodes, which splits any contiguous numbering evenly
+            return static_cast<uint8_t>((id & 0xff) % count_);
+        }
+
+        bool ShardMap::peer_alive(uint8_t index, uint32_t now) const
+        {
+            if (index == index_ || !(seen_mask_.load() & (1 << index)))
+                return true;
+            // A heartbeat may be recorded on the main loop after `now` was taken
+            return static_cast<int32_t>(now - last_seen_[index].load()) < static_cast<int32_t>(failover_timeout_);
+        }
+
+        bool ShardMap::owns(uint32_t target, uint32_t now) const
+        {
+            if (!enabled())
+                return true;
+
+            const uint8_t shard = shard_of(target);
+            if (shard == index_)
+                return true;
+            if (heartbeat_interval_ == 0 || peer_alive(shard, now))
+                return false;
+
+            // The first live node after the silent one takes over its shard
+            for (uint8_t step = 1; step < count_; step++)
+            {
+                const uint8_t next = (shard + step) % count_;
+                if (next == index_)
+                    return true;
+                if (peer_alive(next, now))
+                    return false;
+            }
+            return false;
+        }
+
+        bool ShardMap::heartbeat_due(uint32_t now)
+        {
+            if (!enabled() || heartbeat_interval_ == 0)
+                return false;
+            if (heartbeat_sent_ && now - last_heartbeat_ < heartbeat_interval_)
+                return false;
+            heartbeat_sent_ = true;
+            last_heartbeat_ = now;
+            return true;
+        }
+
+        size_t ShardMap::build_heartbeat(uint8_t *raw) const
+        {
+            size_t len = 0;
+
+            // Flags: LE general discoverable, BR/EDR not supported
+            raw[len++] = 2;
+            raw[len++] = 0x01;
+            raw[len++] = 0x06;
+
+            raw[len++] = 9;
+            raw[len++] = 0xff;  // Manufacturer specific data
+            raw[len++] = HEARTBEAT_MANUFACTURER_ID & 0xFF;
+            raw[len++] = (HEARTBEAT_MANUFACTURER_ID >> 8) & 0xFF;
+            raw[len++] = 'F';
+            raw[len++] = 'C';
+            raw[len++] = mesh_tag_ & 0xFF;
+            raw[len++] = (mesh_tag_ >> 8) & 0xFF;
+            raw[len++] = index_;
+            raw[len++] = count_;
+            return len;
+        }
+
+        bool ShardMap::on_advertisement(const uint8_t *adv, size_t len, uint32_t now)
+        {
+            if (!enabled() || heartbeat_interval_ == 0)
+                return false;
+
+            size_t data_len;
+            const uint8_t *data = find_manufacturer_data(adv, len, HEARTBEAT_MANUFACTURER_ID, data_len);
+            if (data == nullptr || data_len != 6 || data[0] != 'F' || data[1] != 'C')
+                return false;
+
+            const uint16_t tag = data[2] | (data[3] << 8);
+            const uint8_t index = data[4];
+            if (tag != mesh_tag_ || data[5] != count_ || index >= count_ || index == index_)
+                return false;
+
+            last_seen_[index] = now;
+            seen_mask_ |= static_cast<uint8_t>(1 << index);
+            return true;
+        }
+
+        void ShardMap::update(uint32_t now)
+        {
+            if (!enabled() || heartbeat_interval_ == 0)
+                return;
+
+            for (uint8_t i = 0; i < count_; i++)
+            {
+                const uint8_t bit = 1 << i;
+                const bool alive = peer_alive(i, now);
+                if (alive == ((alive_mask_ & bit) != 0))
+                    continue;
+                if (alive)
+                {
+                    alive_mask_ |= bit;
+                    ESP_LOGI(TAG, "Controller %d is back, handing its lights back", i);
+                }
+                else
+                {
+                    alive_mask_ &= ~bit;
+                    ESP_LOGW(TAG, "No heartbeat from controller %d for %dms, taking over its lights if next in line", i,
+                             failover_timeout_);
+                }
+            }
+        }
+    } // namespace fastcon
+} // namespace esphome
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Splits the light and group IDs of one mesh between several controllers so each node only
+        // transmits for its own shard. With failover enabled, nodes broadcast a heartbeat and take over
+        // the shard of a peer that has gone silent.
+        class ShardMap
+        {
+        public:
+            static const uint8_t MAX_SHARDS = 8;
+            // Bluetooth SIG company ID reserved for testing; bulbs ignore it
+            static const uint16_t HEARTBEAT_MANUFACTURER_ID = 0xffff;
+            static const size_t HEARTBEAT_ADV_SIZE = 13;
+
+            enum class Strategy : uint8_t
+            {
+                RANGE,  // Contiguous blocks of IDs
+                HASH    // Interleave IDs (id % count), so neighbouring lights land on different nodes
+            };
+
+            void configure(uint8_t index, uint8_t count, Strategy strategy);
+            // heartbeat_interval = 0 disables heartbeats and failover
+            void set_failover(uint32_t heartbeat_interval, uint32_t timeout);
+            void set_mesh_tag(uint16_t tag) { mesh_tag_ = tag; }
+
+            bool enabled() const { return count_ > 1; }
+            uint8_t index() const { return index_; }
+            uint8_t count() const { return count_; }
+
+            uint8_t shard_of(uint32_t target) const;
+            // True if this node transmits for `target` (a light or group target)
+            bool owns(uint32_t target, uint32_t now) const;
+            bool peer_alive(uint8_t index, uint32_t now) const;
+
+            // Consumer side: true (once per interval) when a heartbeat should go on air
+            bool heartbeat_due(uint32_t now);
+            size_t build_heartbeat(uint8_t *raw) const;
+            // Any task: records the heartbeat if `adv` carries one from a peer of this mesh
+            bool on_advertisement(const uint8_t *adv, size_t len, uint32_t now);
+            // Main loop: logs peers going silent or coming back
+            void update(uint32_t now);
+
+        protected:
+            uint8_t index_{0};
+            uint8_t count_{1};
+            Strategy strategy_{Strategy::HASH};
+            uint16_t mesh_tag_{0};
+            uint32_t heartbeat_interval_{0};
+            uint32_t failover_timeout_{0};
+            uint32_t last_heartbeat_{0};
+            bool heartbeat_sent_{false};
+
+            // Peers never heard since boot are assumed alive, so a node starting alone does not take
+            // over the whole mesh
+            std::array<std::atomic<uint32_t>, MAX_SHARDS> last_seen_{};
+            std::atomic<uint8_t> seen_mask_{0};
+            uint8_t alive_mask_{0xff};  // Last state logged by update()
+        };
+    } // namespace fastcon
+} // namespace esphome
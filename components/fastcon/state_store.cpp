@@ -0,0 +1,91 @@
+#include "state_store.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        static const uint8_t SEQUENCE_RING = 254;
+
+        static uint8_t sequence_position(uint8_t sequence) { return sequence == 0 ? 0 : sequence - 1; }
+
+        uint8_t StateStore::advance_sequence(uint8_t sequence, uint8_t count)
+        {
+            return (sequence_position(sequence) + count) % SEQUENCE_RING + 1;
+        }
+
+        uint8_t StateStore::sequence_distance(uint8_t from, uint8_t to)
+        {
+            return (sequence_position(to) + SEQUENCE_RING - sequence_position(from)) % SEQUENCE_RING;
+        }
+
+        bool StateStore::load(uint32_t sequence_key, uint32_t lights_key, uint8_t &sequence, LightStates &lights)
+        {
+            sequence_pref_ = global_preferences->make_preference<uint8_t>(sequence_key, true);
+            // Resume at the stored lease (or the current sequence if there is none) and take a new lease
+            // right away, before the first number is handed out
+            uint8_t lease;
+            if (sequence_pref_.load(&lease))
+                sequence = lease;
+            sequence_lease_ = advance_sequence(sequence, SEQUENCE_LEASE);
+            lease_pending_ = true;
+
+            lights_.reset(new LightStates());
+            lights_pref_ = global_preferences->make_preference<LightStates>(lights_key, true);
+            if (!lights_pref_.load(lights_.get()))
+            {
+                lights_->fill(CachedLightState());
+                return false;
+            }
+            lights = *lights_;
+            return true;
+        }
+
+        bool StateStore::update_sequence(uint8_t sequence, bool force)
+        {
+            if (lights_ == nullptr)
+                return false;
+
+            if (force)
+            {
+                // A clean shutdown resumes exactly where it stopped
+                const bool changed = sequence_lease_.exchange(sequence) != sequence;
+                lease_pending_ = lease_pending_ || changed;
+                return changed;
+            }
+            if (sequence_distance(sequence, sequence_lease_) >= SEQUENCE_LEASE / 2)
+                return false;
+            sequence_lease_ = advance_sequence(sequence, SEQUENCE_LEASE);
+            lease_pending_ = true;
+            return true;
+        }
+
+        bool StateStore::update_lights(uint32_t now, const LightStates &lights, bool force)
+        {
+            if (lights_ == nullptr || !(force || now - last_light_save_ >= save_interval_) || *lights_ == lights)
+                return false;
+            *lights_ = lights;
+            last_light_save_ = now;
+            return true;
+        }
+
+        bool StateStore::save_sequence()
+        {
+            if (lights_ == nullptr)
+                return false;
+            // Cleared first: a renewal that races with the save stays pending for the next one
+            lease_pending_ = false;
+            uint8_t lease = sequence_lease_;
+            if (sequence_pref_.save(&lease))
+                return true;
+            lease_pending_ = true;
+            return false;
+        }
+
+        bool StateStore::save_lights()
+        {
+            if (lights_ == nullptr)
+                return false;
+            return lights_pref_.save(lights_.get());
+        }
+    } // namespace fastcon
+} // namespace esphome
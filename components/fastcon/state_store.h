@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "esphome/core/preferences.h"
+#include "protocol.h"
+
+namespace esphome
+{
+    namespace fastcon
+    {
+        // Keeps the mesh sequence number and the last state sent to each light in flash, so a restart
+        // neither repeats recent sequence numbers nor re-sends states the bulbs already have.
+        //
+        // The sequence is stored as a lease: the value saved is ahead of the one in use, and a new lease
+        // is taken only when half of it has been used, so a restart resumes past anything sent under the
+        // old lease. The consumer renews it as numbers are handed out and the main loop syncs it to flash,
+        // once per SEQUENCE_LEASE / 2 packets, in its own one-byte preference; it must survive a power
+        // loss. The light table
+        // (about 1.8KB) is a separate preference, saved at most once per save interval and only when it
+        // changed, and left to ESPHome's batched flash writes.
+        class StateStore
+        {
+        public:
+            using LightStates = std::array<CachedLightState, 256>;
+            static const uint8_t SEQUENCE_LEASE = 96;
+
+            void set_save_interval(uint32_t interval) { save_interval_ = interval; }
+
+            // Restores `sequence` and `lights` from the preferences stored under the two keys; each is
+            // left unchanged if nothing is stored for it. Returns true if the light states were restored
+            bool load(uint32_t sequence_key, uint32_t lights_key, uint8_t &sequence, LightStates &lights);
+            // Consumer side, with the current values: true if the stored copy changed and should be saved.
+            // update_sequence() runs for every sequence number handed out, so the lease is renewed before
+            // it can be overtaken; a renewal stays pending until save_sequence(). `force` stores the exact
+            // sequence and the light states regardless of the save interval (shutdown)
+            bool update_sequence(uint8_t sequence, bool force = false);
+            bool update_lights(uint32_t now, const LightStates &lights, bool force = false);
+            // Main loop side
+            bool lease_pending() const { return lease_pending_; }
+            bool save_sequence();
+            bool save_lights();
+
+            bool enabled() const { return lights_ != nullptr; }
+
+        protected:
+
+            // Sequence numbers run 1-254 once the counter has wrapped (0 is only used before that)
+            static uint8_t advance_sequence(uint8_t sequence, uint8_t count);
+            static uint8_t sequence_distance(uint8_t from, uint8_t to);
+
+            // Written by the consumer, saved from the main loop
+            std::atomic<uint8_t> sequence_lease_{0};
+            std::atomic<bool> lease_pending_{false};
+            ESPPreferenceObject sequence_pref_;
+            // Allocated by load(), so a controller that does not restore state pays no RAM for it
+            std::unique_ptr<LightStates> lights_;
+            ESPPreferenceObject lights_pref_;
+            uint32_t save_interval_{10000};
+            uint32_t last_light_save_{0};
+        };
+    } // namespace fastcon
+} // namespace esphome
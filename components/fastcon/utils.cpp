@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <vector>
 #include <cstdio>
+#include "esphome/core/defines.h"
 #include "esphome/core/log.h"
 #include "utils.h"
 
@@ -7,6 +9,9 @@ namespace esphome
 {
     namespace fastcon
     {
+#ifdef FASTCON_COMPACT_ENCODER
+        // Bitwise implementations for flash-constrained targets (no lookup tables)
+
         uint8_t reverse_8(uint8_t d)
         {
             uint8_t result = 0;
@@ -27,53 +32,110 @@ namespace esphome
             return result;
         }
 
-        uint16_t crc16(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data)
+        static inline uint16_t crc16_update(uint16_t crc, uint8_t byte)
         {
-            uint16_t crc = 0xffff;
+            crc ^= (static_cast<uint16_t>(byte) << 8);
+            for (int j = 0; j < 4; j++)
+            {
+                uint16_t tmp = crc << 1;
+                if (crc & 0x8000)
+                {
+                    tmp ^= 0x1021;
+                }
+                crc = tmp << 1;
+                if (tmp & 0x8000)
+                {
+                    crc ^= 0x1021;
+                }
+            }
+            return crc;
+        }
+#else
+        // Lookup tables generated at compile time; 768 bytes of flash in exchange for
+        // a single table lookup per byte instead of 8 bit-steps. Neither Xtensa nor the
+        // ESP32 RISC-V cores provide a bit-reverse instruction, so reversal is table based too.
 
-            // Process address in reverse
-            for (auto it = addr.rbegin(); it != addr.rend(); ++it)
+        struct Reverse8Table
+        {
+            uint8_t values[256];
+
+            constexpr Reverse8Table() : values()
             {
-                crc ^= (static_cast<uint16_t>(*it) << 8);
-                for (int j = 0; j < 4; j++)
+                for (int d = 0; d < 256; d++)
                 {
-                    uint16_t tmp = crc << 1;
-                    if (crc & 0x8000)
-                    {
-                        tmp ^= 0x1021;
-                    }
-                    crc = tmp << 1;
-                    if (tmp & 0x8000)
+                    uint8_t result = 0;
+                    for (int i = 0; i < 8; i++)
                     {
-                        crc ^= 0x1021;
+                        result |= ((d >> i) & 1) << (7 - i);
                     }
+                    values[d] = result;
                 }
             }
+        };
 
-            // Process data
-            for (size_t i = 0; i < data.size(); i++)
+        struct Crc16Table
+        {
+            uint16_t values[256];
+
+            constexpr Crc16Table() : values()
             {
-                crc ^= (static_cast<uint16_t>(reverse_8(data[i])) << 8);
-                for (int j = 0; j < 4; j++)
+                for (int b = 0; b < 256; b++)
                 {
-                    uint16_t tmp = crc << 1;
-                    if (crc & 0x8000)
-                    {
-                        tmp ^= 0x1021;
-                    }
-                    crc = tmp << 1;
-                    if (tmp & 0x8000)
+                    uint16_t crc = static_cast<uint16_t>(b << 8);
+                    for (int j = 0; j < 8; j++)
                     {
-                        crc ^= 0x1021;
+                        crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
                     }
+                    values[b] = crc;
                 }
             }
+        };
+
+        static constexpr Reverse8Table REVERSE_8_TABLE{};
+        static constexpr Crc16Table CRC16_TABLE{};
+
+        uint8_t reverse_8(uint8_t d)
+        {
+            return REVERSE_8_TABLE.values[d];
+        }
+
+        uint16_t reverse_16(uint16_t d)
+        {
+            return (static_cast<uint16_t>(REVERSE_8_TABLE.values[d & 0xFF]) << 8) | REVERSE_8_TABLE.values[d >> 8];
+        }
+
+        static inline uint16_t crc16_update(uint16_t crc, uint8_t byte)
+        {
+            return static_cast<uint16_t>(crc << 8) ^ CRC16_TABLE.values[(crc >> 8) ^ byte];
+        }
+#endif
+
+        uint16_t crc16(const uint8_t *addr, size_t addr_len, const uint8_t *data, size_t data_len)
+        {
+            uint16_t crc = 0xffff;
+
+            // Process address in reverse
+            for (size_t i = addr_len; i-- > 0;)
+            {
+                crc = crc16_update(crc, addr[i]);
+            }
+
+            // Process data
+            for (size_t i = 0; i < data_len; i++)
+            {
+                crc = crc16_update(crc, reverse_8(data[i]));
+            }
 
             crc = ~reverse_16(crc);
             return crc;
         }
 
-        void whitening_init(uint32_t val, WhiteningContext &ctx)
+        uint16_t crc16(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data)
+        {
+            return crc16(addr.data(), addr.size(), data.data(), data.size());
+        }
+
+        static constexpr void whitening_seed(uint32_t val, WhiteningContext &ctx)
         {
             uint32_t v0[] = {(val >> 5), (val >> 4), (val >> 3), (val >> 2)};
 
@@ -86,40 +148,97 @@ namespace esphome
             ctx.f_0x18 = val & 1;
         }
 
+        // The whitening sequence does not depend on the data, so each step yields one keystream byte
+        static constexpr uint8_t whitening_next(WhiteningContext &ctx)
+        {
+            uint32_t varC = ctx.f_0xc;
+            uint32_t var14 = ctx.f_0x14;
+            uint32_t var18 = ctx.f_0x18;
+            uint32_t var10 = ctx.f_0x10;
+            uint32_t var8 = var14 ^ ctx.f_0x8;
+            uint32_t var4 = var10 ^ ctx.f_0x4;
+            uint32_t _var = var18 ^ varC;
+            uint32_t var0 = _var ^ ctx.f_0x0;
+
+            uint8_t key = ((var8 ^ var18) << 7) | (var0 << 6) | (var4 << 5) | (var8 << 4) | (_var << 3) | (var10 << 2) | (var14 << 1) | (var18 << 0);
+
+            ctx.f_0x8 = var4;
+            ctx.f_0xc = var8;
+            ctx.f_0x10 = var8 ^ varC;
+            ctx.f_0x14 = var0 ^ var10;
+            ctx.f_0x18 = var4 ^ var14;
+            ctx.f_0x0 = var8 ^ var18;
+            ctx.f_0x4 = var0;
+            return key;
+        }
+
+        // Keystream for the fixed protocol seed, generated at compile time
+        struct WhiteningKeystream
+        {
+            uint8_t values[WHITENING_KEYSTREAM_SIZE];
+
+            constexpr WhiteningKeystream(uint32_t seed) : values()
+            {
+                WhiteningContext ctx;
+                whitening_seed(seed, ctx);
+                for (size_t i = 0; i < WHITENING_KEYSTREAM_SIZE; i++)
+                {
+                    values[i] = whitening_next(ctx);
+                }
+            }
+        };
+
+        static constexpr WhiteningKeystream DEFAULT_WHITENING_KEYSTREAM{DEFAULT_WHITENING_SEED};
+
+        void whitening_init(uint32_t val, WhiteningContext &ctx)
+        {
+            whitening_seed(val, ctx);
+        }
+
+        void whitening_encode(uint8_t *data, size_t len, WhiteningContext &ctx)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                data[i] ^= whitening_next(ctx);
+            }
+        }
+
+        bool whitening_encode_default(uint8_t *data, size_t len, size_t offset)
+        {
+            if (offset > WHITENING_KEYSTREAM_SIZE || len > WHITENING_KEYSTREAM_SIZE - offset)
+                return false;
+
+            const uint8_t *key = DEFAULT_WHITENING_KEYSTREAM.values + offset;
+            for (size_t i = 0; i < len; i++)
+            {
+                data[i] ^= key[i];
+            }
+            return true;
+        }
+
         void whitening_encode(std::vector<uint8_t> &data, WhiteningContext &ctx)
         {
-            for (size_t i = 0; i < data.size(); i++)
+            whitening_encode(data.data(), data.size(), ctx);
+        }
+
+        const char *bytes_to_hex_string(const uint8_t *data, size_t len, char *buf, size_t buf_size)
+        {
+            if (buf_size == 0)
+                return buf;
+
+            size_t count = std::min(len, (buf_size - 1) / 2);
+            for (size_t i = 0; i < count; i++)
             {
-                uint32_t varC = ctx.f_0xc;
-                uint32_t var14 = ctx.f_0x14;
-                uint32_t var18 = ctx.f_0x18;
-                uint32_t var10 = ctx.f_0x10;
-                uint32_t var8 = var14 ^ ctx.f_0x8;
-                uint32_t var4 = var10 ^ ctx.f_0x4;
-                uint32_t _var = var18 ^ varC;
-                uint32_t var0 = _var ^ ctx.f_0x0;
-
-                uint8_t c = data[i];
-                data[i] = ((c & 0x80) ^ ((var8 ^ var18) << 7)) + ((c & 0x40) ^ (var0 << 6)) + ((c & 0x20) ^ (var4 << 5)) + ((c & 0x10) ^ (var8 << 4)) + ((c & 0x08) ^ (_var << 3)) + ((c & 0x04) ^ (var10 << 2)) + ((c & 0x02) ^ (var14 << 1)) + ((c & 0x01) ^ (var18 << 0));
-
-                ctx.f_0x8 = var4;
-                ctx.f_0xc = var8;
-                ctx.f_0x10 = var8 ^ varC;
-                ctx.f_0x14 = var0 ^ var10;
-                ctx.f_0x18 = var4 ^ var14;
-                ctx.f_0x0 = var8 ^ var18;
-                ctx.f_0x4 = var0;
+                sprintf(buf + (i * 2), "%02X", data[i]);
             }
+            buf[count * 2] = '\0'; // Ensure null termination
+            return buf;
         }
 
         std::vector<char> vector_to_hex_string(std::vector<uint8_t> &data)
         {
             std::vector<char> hex_str(data.size() * 2 + 1); // Allocate the vector with the required size
-            for (size_t i = 0; i < data.size(); i++)
-            {
-                sprintf(hex_str.data() + (i * 2), "%02X", data[i]);
-            }
-            hex_str[data.size() * 2] = '\0'; // Ensure null termination
+            bytes_to_hex_string(data.data(), data.size(), hex_str.data(), hex_str.size());
             return hex_str;
         }
     } // namespace fastcon
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -12,6 +13,7 @@ namespace esphome
         uint16_t reverse_16(uint16_t d);
 
         // CRC calculation
+        uint16_t crc16(const uint8_t *addr, size_t addr_len, const uint8_t *data, size_t data_len);
         uint16_t crc16(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &data);
 
         // Whitening context and functions
@@ -25,12 +27,21 @@ namespace esphome
             uint32_t f_0x14;
             uint32_t f_0x18;
 
-            WhiteningContext() : f_0x0(0), f_0x4(0), f_0x8(0), f_0xc(0), f_0x10(0), f_0x14(0), f_0x18(0) {}
+            constexpr WhiteningContext() : f_0x0(0), f_0x4(0), f_0x8(0), f_0xc(0), f_0x10(0), f_0x14(0), f_0x18(0) {}
         };
 
         void whitening_init(uint32_t val, WhiteningContext &ctx);
+        void whitening_encode(uint8_t *data, size_t len, WhiteningContext &ctx);
         void whitening_encode(std::vector<uint8_t> &data, WhiteningContext &ctx);
 
+        // Whitening with the protocol's fixed seed uses a precomputed keystream. `offset` is the
+        // position of `data` within the whitened frame; returns false if it runs past the keystream.
+        static const uint32_t DEFAULT_WHITENING_SEED = 0x25;
+        static const size_t WHITENING_KEYSTREAM_SIZE = 48;
+        bool whitening_encode_default(uint8_t *data, size_t len, size_t offset = 0);
+
+        // Writes `len` bytes as uppercase hex into `buf` (truncated to fit) and returns `buf`
+        const char *bytes_to_hex_string(const uint8_t *data, size_t len, char *buf, size_t buf_size);
         std::vector<char> vector_to_hex_string(std::vector<uint8_t> &data);
     } // namespace fastcon
-} // namespace esphome
\ No newline at end of file
+} // namespace esphome
@@ -0,0 +1,134 @@
+// Host-side encoder benchmark: time and heap allocations per packet for each encoder stage.
+// Usage: bench_protocol [iterations]. Exits non-zero if a buffer-based stage allocates.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "golden_vectors.h"
+#include "harness.h"
+
+using namespace esphome::fastcon;
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+
+// Keeps the optimizer from discarding the work being measured
+static volatile uint32_t sink;
+
+struct Result
+{
+    double ns;
+    double allocations;
+};
+
+template<typename F>
+static Result measure(size_t iterations, F &&step)
+{
+    const size_t before = allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        step(i);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const size_t allocated = allocations.load() - before;
+    return {std::chrono::duration<double, std::nano>(elapsed).count() / iterations, static_cast<double>(allocated) / iterations};
+}
+
+static bool report(const char *name, const Result &result, bool must_not_allocate)
+{
+    printf("%-32s %10.1f ns %8.2f allocs\n", name, result.ns, result.allocations);
+    if (must_not_allocate && result.allocations > 0)
+    {
+        printf("  ^ allocates on the heap; the buffer API must not\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    if (iterations == 0)
+        return 1;
+
+    const std::vector<uint8_t> addr = harness::from_hex(golden::ADDRESS);
+    const std::vector<uint8_t> data = harness::from_hex(golden::DATA);
+    const std::array<uint8_t, 4> key = {golden::MESH_KEY[0], golden::MESH_KEY[1], golden::MESH_KEY[2], golden::MESH_KEY[3]};
+    const uint8_t light_data[] = {0xff, 0x10, 0x20, 0x30, 0x00, 0x00};
+    std::array<uint8_t, CONTROL_PAYLOAD_SIZE> control{};
+    write_control_record(control.data(), control.size(), 0, CONTROL_TYPE_SINGLE, 1, light_data, sizeof(light_data));
+
+#ifdef FASTCON_COMPACT_ENCODER
+    printf("Encoder: compact (bitwise loops), %zu iterations\n", iterations);
+#else
+    printf("Encoder: lookup tables, %zu iterations\n", iterations);
+#endif
+
+    bool ok = true;
+    ok &= report("crc16", measure(iterations, [&](size_t i)
+                                  { sink = crc16(addr.data(), addr.size(), control.data(), control.size() - (i & 1)); }),
+                 true);
+
+    ok &= report("whitening_encode_default", measure(iterations, [&](size_t i)
+                                                     {
+                                                         uint8_t buf[MAX_RF_PAYLOAD_SIZE] = {static_cast<uint8_t>(i)};
+                                                         whitening_encode_default(buf, sizeof(buf), RF_PAYLOAD_OFFSET);
+                                                         sink = buf[0];
+                                                     }),
+                 true);
+
+    ok &= report("whitening_encode (seeded)", measure(iterations, [&](size_t i)
+                                                      {
+                                                          uint8_t buf[MAX_RF_PAYLOAD_SIZE] = {static_cast<uint8_t>(i)};
+                                                          WhiteningContext ctx;
+                                                          whitening_init(DEFAULT_WHITENING_SEED, ctx);
+                                                          whitening_encode(buf, sizeof(buf), ctx);
+                                                          sink = buf[0];
+                                                      }),
+                 true);
+
+    ok &= report("get_rf_payload", measure(iterations, [&](size_t i)
+                                           {
+                                               uint8_t rf[RF_BUFFER_SIZE];
+                                               sink = get_rf_payload(addr.data(), addr.size(), control.data(), control.size() - (i & 1), rf, sizeof(rf));
+                                           }),
+                 true);
+
+    ok &= report("prepare_payload", measure(iterations, [&](size_t i)
+                                            {
+                                                PacketBuffer packet;
+                                                prepare_payload(addr.data(), addr.size(), control.data(), control.size() - (i & 1), packet);
+                                                sink = packet.data()[0];
+                                            }),
+                 true);
+
+    ok &= report("encode_mesh_command (packet)", measure(iterations, [&](size_t i)
+                                                         {
+                                                             PacketBuffer packet;
+                                                             encode_mesh_command(5, 1, i, key, control.data(), control.size(), packet, true);
+                                                             sink = packet.data()[0];
+                                                         }),
+                 true);
+
+    // The vector API is kept for compatibility; shown for comparison only
+    report("prepare_payload (vector API)", measure(iterations, [&](size_t i)
+                                                   {
+                                                       std::vector<uint8_t> packet = prepare_payload(addr, data);
+                                                       sink = packet[i % packet.size()];
+                                                   }),
+           false);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+// Payloads of the reference encoder (mesh key 30323336), as hex. Any change to these bytes changes
+// what goes on air; update them only together with a capture from real bulbs.
+namespace golden
+{
+    static const uint8_t MESH_KEY[4] = {0x30, 0x32, 0x33, 0x36};
+
+    // Single light control packets: light data wrapped in a control record, encoded as command type 5
+    struct ControlVector
+    {
+        uint32_t light_id;
+        uint8_t sequence;
+        const char *light_data;
+        const char *payload;
+    };
+
+    static const ControlVector CONTROL[] = {
+        {1, 0, "00", "6db64368931ddd0595578a3b17fd0bce4295c4675bf93b3a"},
+        {1, 1, "40", "6db64368931ddd0495148a3b57fd0bce4295c4675bf9cc4e"},
+        {1, 2, "ff1020300000", "6db64368931ddd0795a4da3be8ed2bfe4295c4675bf93b13"},
+        {1, 3, "bf0000007f80", "6db64368931ddd069544da3ba8fd0bce3d15c4675bf9caf7"},
+        {2, 4, "00", "6db64368931ddd0195508a3817fd0bce4295c4675bf972f4"},
+        {2, 5, "40", "6db64368931ddd0095118a3857fd0bce4295c4675bf9df8b"},
+        {2, 6, "ff1020300000", "6db64368931ddd0395a1da38e8ed2bfe4295c4675bf928d6"},
+        {2, 7, "bf0000007f80", "6db64368931ddd029541da38a8fd0bce3d15c4675bf9d932"},
+        {7, 8, "00", "6db64368931ddd0d95498a3d17fd0bce4295c4675bf968f4"},
+        {7, 9, "40", "6db64368931ddd0c95068a3d57fd0bce4295c4675bf943bb"},
+        {7, 10, "ff1020300000", "6db64368931ddd0f9596da3de8ed2bfe4295c4675bf91453"},
+        {7, 11, "bf0000007f80", "6db64368931ddd0e9536da3da8fd0bce3d15c4675bf9b4d4"},
+        {200, 12, "00", "6db64368931ddd0995828af217fd0bce4295c4675bf9ef19"},
+        {200, 13, "40", "6db64368931ddd0895438af257fd0bce4295c4675bf9e0a0"},
+        {200, 14, "ff1020300000", "6db64368931ddd0b95d3daf2e8ed2bfe4295c4675bf9b748"},
+        {200, 15, "bf0000007f80", "6db64368931ddd0a9573daf2a8fd0bce3d15c4675bf917cf"},
+        {255, 16, "00", "6db64368931ddd1595498ac517fd0bce4295c4675bf98577"},
+        {255, 17, "40", "6db64368931ddd1495068ac557fd0bce4295c4675bf9ae38"},
+        {255, 18, "ff1020300000", "6db64368931ddd179596dac5e8ed2bfe4295c4675bf9f9d0"},
+        {255, 19, "bf0000007f80", "6db64368931ddd169536dac5a8fd0bce3d15c4675bf95957"},
+        {300, 20, "00", "6db64368931ddc1195178a1617fd0bce4295c4675bf9c308"},
+        {300, 21, "40", "6db64368931ddc1095d48a1657fd0bce4295c4675bf996ba"},
+        {300, 22, "ff1020300000", "6db64368931ddc139564da16e8ed2bfe4295c4675bf961e7"},
+        {300, 23, "bf0000007f80", "6db64368931ddc129504da16a8fd0bce3d15c4675bf932c5"},
+        {5, 24, "00", "6db64368931ddd1d953b8a3f17fd0bce4295c4675bf9d57a"},
+        {5, 124, "64", "6db64368931ddd7995738a3f73fd0bce4295c4675bf96c87"},
+        {5, 254, "e6", "6db64368931dddfb956f8a3ff1fd0bce4295c4675bf9f9b3"},
+        {5, 1, "e7", "6db64368931ddd04956b8a3ff0fd0bce4295c4675bf92563"},
+        {5, 29, "03", "6db64368931ddd1895338a3f14fd0bce4295c4675bf94743"},
+    };
+
+    // prepare_payload(), get_rf_payload() and crc16() of ADDRESS and DATA
+    static const char *const ADDRESS = "010203";
+    static const char *const DATA = "090807060504030201";
+    static const char *const PREPARED = "6db6436b901e5a3bdfbc9d0c27c93afdde";
+    static const char *const RF_FRAME = "0000000000000000000000000000008ef0aac0408009080706050403020101af";
+    static const uint16_t CRC = 0xaf01;
+
+    // whitening_encode() of 40 bytes of 0xa5, per seed
+    struct WhiteningVector
+    {
+        uint32_t seed;
+        const char *output;
+    };
+
+    static const WhiteningVector WHITENING[] = {
+        {0x25, "2877f2049802c315d094b4ed33d25d46e34c0e753bf6967d1f3dad816e9e59d40651f0cd6a0cbcc9"},
+        {0x00, "e5171966ba92effa2053393f647360e185fc7b442abe000ae7deeb68c54ec78735894a55622877f2"},
+        {0x7f, "622877f2049802c315d094b4ed33d25d46e34c0e753bf6967d1f3dad816e9e59d40651f0cd6a0cbc"},
+        {0x13, "2e2ce5171966ba92effa2053393f647360e185fc7b442abe000ae7deeb68c54ec78735894a556228"},
+    };
+} // namespace golden
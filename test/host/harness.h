@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "protocol.h"
+#include "utils.h"
+
+// Helpers shared by the host-side protocol test and benchmark
+namespace harness
+{
+    using namespace esphome::fastcon;
+
+    inline std::vector<uint8_t> from_hex(const char *hex)
+    {
+        std::vector<uint8_t> bytes;
+        for (size_t i = 0; hex[i] != '\0' && hex[i + 1] != '\0'; i += 2)
+        {
+            unsigned int value;
+            sscanf(hex + i, "%2x", &value);
+            bytes.push_back(static_cast<uint8_t>(value));
+        }
+        return bytes;
+    }
+
+    inline std::string to_hex(const uint8_t *data, size_t len)
+    {
+        std::string hex;
+        char byte[3];
+        for (size_t i = 0; i < len; i++)
+        {
+            snprintf(byte, sizeof(byte), "%02x", data[i]);
+            hex += byte;
+        }
+        return hex;
+    }
+
+    // What FastconController::single_control() sends: one control record, encoded as command type 5
+    inline bool encode_single_control(uint32_t light_id, uint8_t sequence, const uint8_t *mesh_key, const uint8_t *data,
+                                      size_t len, PacketBuffer &out)
+    {
+        std::array<uint8_t, CONTROL_PAYLOAD_SIZE> control{};
+        if (write_control_record(control.data(), control.size(), 0, CONTROL_TYPE_SINGLE, light_id, data, len) == 0)
+            return false;
+        const std::array<uint8_t, 4> key = {mesh_key[0], mesh_key[1], mesh_key[2], mesh_key[3]};
+        return encode_mesh_command(5, light_id, sequence, key, control.data(), control.size(), out, true);
+    }
+} // namespace harness
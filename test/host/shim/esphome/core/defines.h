@@ -0,0 +1,3 @@
+#pragma once
+
+// Host builds have no ESPHome code generator; nothing is defined
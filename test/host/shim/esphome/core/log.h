@@ -0,0 +1,24 @@
+#pragma once
+
+// Minimal stand-in for ESPHome's logger so the encoder sources build on the host
+
+#define ESPHOME_LOG_LEVEL_NONE 0
+#define ESPHOME_LOG_LEVEL_ERROR 1
+#define ESPHOME_LOG_LEVEL_WARN 2
+#define ESPHOME_LOG_LEVEL_INFO 3
+#define ESPHOME_LOG_LEVEL_CONFIG 4
+#define ESPHOME_LOG_LEVEL_DEBUG 5
+#define ESPHOME_LOG_LEVEL_VERBOSE 6
+#define ESPHOME_LOG_LEVEL_VERY_VERBOSE 7
+
+#ifndef ESPHOME_LOG_LEVEL
+#define ESPHOME_LOG_LEVEL ESPHOME_LOG_LEVEL_NONE
+#endif
+
+#define ESP_LOGE(tag, ...) ((void) (tag))
+#define ESP_LOGW(tag, ...) ((void) (tag))
+#define ESP_LOGI(tag, ...) ((void) (tag))
+#define ESP_LOGD(tag, ...) ((void) (tag))
+#define ESP_LOGV(tag, ...) ((void) (tag))
+#define ESP_LOGVV(tag, ...) ((void) (tag))
+#define ESP_LOGCONFIG(tag, ...) ((void) (tag))
@@ -0,0 +1,235 @@
+// Checks the protocol encoder against golden packets; exits non-zero if any check fails
+#include <cstdio>
+#include <string>
+#include "golden_vectors.h"
+#include "harness.h"
+
+using namespace esphome::fastcon;
+using harness::from_hex;
+using harness::to_hex;
+
+static int failures = 0;
+
+static void expect_bytes(const char *what, const std::string &expected, const uint8_t *data, size_t len)
+{
+    const std::string actual = to_hex(data, len);
+    if (actual == expected)
+        return;
+    printf("FAIL %s\n  expected %s\n  actual   %s\n", what, expected.c_str(), actual.c_str());
+    failures++;
+}
+
+static void expect(const char *what, bool condition)
+{
+    if (condition)
+        return;
+    printf("FAIL %s\n", what);
+    failures++;
+}
+
+static void test_control_packets()
+{
+    const std::array<uint8_t, 4> key = {golden::MESH_KEY[0], golden::MESH_KEY[1], golden::MESH_KEY[2], golden::MESH_KEY[3]};
+    for (const auto &vector : golden::CONTROL)
+    {
+        char what[64];
+        snprintf(what, sizeof(what), "control light %u seq %u data %s", vector.light_id, vector.sequence, vector.light_data);
+
+        const std::vector<uint8_t> data = from_hex(vector.light_data);
+        PacketBuffer packet;
+        expect(what, harness::encode_single_control(vector.light_id, vector.sequence, golden::MESH_KEY, data.data(), data.size(), packet));
+        expect_bytes(what, vector.payload, packet.data(), packet.size());
+
+        // The receive path must recover what was sent
+        uint8_t body[MAX_COMMAND_BODY_SIZE];
+        size_t body_len;
+        DecodedCommand decoded;
+        expect(what, parse_payload(packet.data(), packet.size(), DEFAULT_BLE_FASTCON_ADDRESS.data(), DEFAULT_BLE_FASTCON_ADDRESS.size(),
+                                   body, sizeof(body), body_len) &&
+                         decode_command(body, body_len, key, decoded));
+        expect(what, decoded.type == 5 && decoded.sequence == vector.sequence && decoded.forward &&
+                         decoded.addr_high == ((vector.light_id >> 8) & 0x0f));
+        expect(what, decoded.data.size() == CONTROL_PAYLOAD_SIZE && decoded.data.data()[1] == (vector.light_id & 0xff) &&
+                         memcmp(decoded.data.data() + 2, data.data(), data.size()) == 0);
+    }
+}
+
+static void test_framing()
+{
+    const std::vector<uint8_t> addr = from_hex(golden::ADDRESS);
+    const std::vector<uint8_t> data = from_hex(golden::DATA);
+
+    uint8_t rf[RF_BUFFER_SIZE];
+    const size_t rf_len = get_rf_payload(addr.data(), addr.size(), data.data(), data.size(), rf, sizeof(rf));
+    expect_bytes("get_rf_payload", golden::RF_FRAME, rf, rf_len);
+    const std::vector<uint8_t> rf_vector = get_rf_payload(addr, data);
+    expect_bytes("get_rf_payload (vector)", golden::RF_FRAME, rf_vector.data(), rf_vector.size());
+
+    PacketBuffer packet;
+    expect("prepare_payload", prepare_payload(addr.data(), addr.size(), data.data(), data.size(), packet));
+    expect_bytes("prepare_payload", golden::PREPARED, packet.data(), packet.size());
+    const std::vector<uint8_t> packet_vector = prepare_payload(addr, data);
+    expect_bytes("prepare_payload (vector)", golden::PREPARED, packet_vector.data(), packet_vector.size());
+
+    // Flags and manufacturer header; the declared length is one byte short, as the bulbs expect
+    uint8_t raw[MAX_PACKET_SIZE];
+    char header[16];
+    snprintf(header, sizeof(header), "020106%02xfff0ff", static_cast<unsigned>(packet.size() + 2));
+    const size_t raw_len = write_adv_frame(packet, raw);
+    expect_bytes("write_adv_frame", std::string(header) + golden::PREPARED, raw, raw_len);
+
+    expect("crc16", crc16(addr.data(), addr.size(), data.data(), data.size()) == golden::CRC);
+    expect("crc16 (vector)", crc16(addr, data) == golden::CRC);
+
+    // Frames that cannot fit a legacy advertisement are refused, not truncated
+    const std::vector<uint8_t> too_long(MAX_COMMAND_BODY_SIZE + 1, 0x55);
+    expect("prepare_payload refuses oversized data",
+           !prepare_payload(DEFAULT_BLE_FASTCON_ADDRESS.data(), DEFAULT_BLE_FASTCON_ADDRESS.size(), too_long.data(), too_long.size(), packet));
+}
+
+static void test_receive()
+{
+    const std::vector<uint8_t> addr = from_hex(golden::ADDRESS);
+    std::vector<uint8_t> frame = from_hex(golden::PREPARED);
+    uint8_t body[MAX_COMMAND_BODY_SIZE];
+    size_t body_len = 0;
+
+    // The receive path undoes prepare_payload()
+    expect("parse_payload", parse_payload(frame.data(), frame.size(), addr.data(), addr.size(), body, sizeof(body), body_len));
+    expect_bytes("parse_payload", golden::DATA, body, body_len);
+
+    const std::vector<uint8_t> other_addr = {0x01, 0x02, 0x04};
+    expect("parse_payload rejects another address",
+           !parse_payload(frame.data(), frame.size(), other_addr.data(), other_addr.size(), body, sizeof(body), body_len));
+
+    // Whitening is a plain XOR, so a flipped bit on air is a flipped bit in the de-whitened frame
+    frame.back() ^= 0x01;
+    expect("parse_payload rejects a bad CRC", !parse_payload(frame.data(), frame.size(), addr.data(), addr.size(), body, sizeof(body), body_len));
+    frame.back() ^= 0x01;
+    frame[frame.size() / 2] ^= 0x80;
+    expect("parse_payload rejects corrupted data",
+           !parse_payload(frame.data(), frame.size(), addr.data(), addr.size(), body, sizeof(body), body_len));
+    frame[frame.size() / 2] ^= 0x80;
+
+    expect("parse_payload rejects a truncated frame",
+           !parse_payload(frame.data(), frame.size() - 1, addr.data(), addr.size(), body, sizeof(body), body_len));
+    // Header, address and CRC only just do not fit
+    expect("parse_payload rejects a short frame",
+           !parse_payload(frame.data(), RF_DATA_OFFSET - RF_PAYLOAD_OFFSET + addr.size() + 1, addr.data(), addr.size(), body,
+                          sizeof(body), body_len));
+
+    // A control packet decodes only with this mesh's key
+    const std::array<uint8_t, 4> key = {golden::MESH_KEY[0], golden::MESH_KEY[1], golden::MESH_KEY[2], golden::MESH_KEY[3]};
+    const auto &vector = golden::CONTROL[0];
+    const std::vector<uint8_t> data = from_hex(vector.light_data);
+    PacketBuffer packet;
+    expect("receive: encode", harness::encode_single_control(vector.light_id, vector.sequence, golden::MESH_KEY, data.data(), data.size(), packet));
+    expect("receive: parse", parse_payload(packet.data(), packet.size(), DEFAULT_BLE_FASTCON_ADDRESS.data(), DEFAULT_BLE_FASTCON_ADDRESS.size(),
+                                           body, sizeof(body), body_len));
+    DecodedCommand decoded;
+    expect("decode_command", decode_command(body, body_len, key, decoded));
+    std::array<uint8_t, 4> other_key = key;
+    other_key[3] ^= 0x01;
+    expect("decode_command rejects the wrong safe key", !decode_command(body, body_len, other_key, decoded));
+    body[body_len - 1] ^= 0x01;
+    expect("decode_command rejects a bad checksum", !decode_command(body, body_len, key, decoded));
+    expect("decode_command rejects a short body", !decode_command(body, COMMAND_HEADER_SIZE - 1, key, decoded));
+}
+
+static void test_whitening()
+{
+    for (const auto &vector : golden::WHITENING)
+    {
+        char what[48];
+        snprintf(what, sizeof(what), "whitening seed 0x%02x", vector.seed);
+
+        std::vector<uint8_t> buf(40, 0xa5);
+        WhiteningContext ctx;
+        whitening_init(vector.seed, ctx);
+        whitening_encode(buf, ctx);
+        expect_bytes(what, vector.output, buf.data(), buf.size());
+    }
+
+    // The precomputed keystream must match the generator at every offset it covers
+    for (size_t offset = 0; offset < WHITENING_KEYSTREAM_SIZE; offset++)
+    {
+        std::vector<uint8_t> expected(WHITENING_KEYSTREAM_SIZE, 0x3c);
+        WhiteningContext ctx;
+        whitening_init(DEFAULT_WHITENING_SEED, ctx);
+        whitening_encode(expected, ctx);
+
+        std::vector<uint8_t> actual(WHITENING_KEYSTREAM_SIZE - offset, 0x3c);
+        expect("whitening_encode_default", whitening_encode_default(actual.data(), actual.size(), offset));
+        expect_bytes("whitening_encode_default", to_hex(expected.data() + offset, actual.size()), actual.data(), actual.size());
+    }
+    uint8_t byte = 0;
+    expect("whitening_encode_default past the keystream", !whitening_encode_default(&byte, 1, WHITENING_KEYSTREAM_SIZE));
+}
+
+static void test_bit_reversal()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint8_t expected = 0;
+        for (int bit = 0; bit < 8; bit++)
+            expected |= ((i >> bit) & 1) << (7 - bit);
+        expect("reverse_8", reverse_8(i) == expected);
+    }
+    for (uint32_t i = 0; i < 65536; i++)
+    {
+        uint16_t expected = 0;
+        for (int bit = 0; bit < 16; bit++)
+            expected |= ((i >> bit) & 1) << (15 - bit);
+        if (reverse_16(i) != expected)
+        {
+            expect("reverse_16", false);
+            break;
+        }
+    }
+}
+
+static void test_color_temperature()
+{
+    // The integer table must reproduce the original float interpolation at every whole mired
+    for (uint16_t mireds = 100; mireds <= 600; mireds++)
+    {
+        uint8_t expected_warm = 0xff, expected_cold = 0x00;
+        if (mireds > MAX_MIREDS)
+        {
+            expected_warm = 0x00;
+            expected_cold = 0xff;
+        }
+        else if (mireds >= MIN_MIREDS)
+        {
+            const float t = mireds;
+            expected_warm = static_cast<uint8_t>(((500 - t) * 255.0f) / (500 - 153));
+            expected_cold = static_cast<uint8_t>(((t - 153) * 255.0f) / (500 - 153));
+        }
+
+        uint8_t warm, cold;
+        color_temperature_channels(mireds, warm, cold);
+        if (warm != expected_warm || cold != expected_cold)
+        {
+            printf("FAIL color temperature %u mireds: %02x%02x, expected %02x%02x\n", mireds, warm, cold, expected_warm, expected_cold);
+            failures++;
+        }
+    }
+}
+
+int main()
+{
+    test_control_packets();
+    test_framing();
+    test_receive();
+    test_whitening();
+    test_bit_reversal();
+    test_color_temperature();
+
+    if (failures > 0)
+    {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All protocol checks passed (%zu golden packets)\n", sizeof(golden::CONTROL) / sizeof(golden::CONTROL[0]));
+    return 0;
+}